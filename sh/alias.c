@@ -43,40 +43,38 @@
 #include "options.h"	/* XXX for argptr (should remove?) */
 #include "builtins.h"
 
-#define ATABSIZE 39
-
-static struct alias* atab[ATABSIZE];
-static int32_t aliases;
+static struct hashtab atab = HASHTAB_INIT(MT_ALIAS);
+int32_t aliases;		/* number of aliases defined */
+uint32_t aliasgen;	/* incremented whenever an alias changes */
 
 static void setalias(const_cstring_t, const_cstring_t);
 static int32_t unalias(const_cstring_t);
-static struct alias** hashalias(const_cstring_t);
+static struct alias* findalias(const_cstring_t, uint32_t);
 
 static
 void
 setalias(const_cstring_t name, const_cstring_t val)
 {
-	struct alias* ap, **app;
-	app = hashalias(name);
-	for (ap = *app; ap; ap = ap->next)
+	struct alias* ap;
+	uint32_t hashval;
+	aliasgen++;
+	hashval = hashstr(name);
+	ap = findalias(name, hashval);
+	if (ap != NULL)
 	{
-		if (equal(name, ap->name))
-		{
-			INTOFF;
-			ckfree(ap->val);
-			ap->val	= savestr(val);
-			INTON;
-			return;
-		}
+		INTOFF;
+		ckfree(ap->val);
+		ap->val	= savestrtag(val, MT_ALIAS);
+		INTON;
+		return;
 	}
 	/* not found */
 	INTOFF;
-	ap = ckmalloc(sizeof(struct alias));
-	ap->name = savestr(name);
-	ap->val = savestr(val);
+	ap = ckmalloctag(sizeof(struct alias), MT_ALIAS);
+	ap->name = savestrtag(name, MT_ALIAS);
+	ap->val = savestrtag(val, MT_ALIAS);
 	ap->flag = 0;
-	ap->next = *app;
-	*app = ap;
+	hashinsert(&atab, &ap->hent, hashval);
 	aliases++;
 	INTON;
 }
@@ -84,74 +82,60 @@ setalias(const_cstring_t name, const_cstring_t val)
 static int32_t
 unalias(const_cstring_t name)
 {
-	struct alias* ap, **app;
-	app = hashalias(name);
-	for (ap = *app; ap; app = &(ap->next), ap = ap->next)
+	struct alias* ap;
+	ap = findalias(name, hashstr(name));
+	if (ap == NULL)
+		return (1);
+	/*
+	 * if the alias is currently in use (i.e. its
+	 * buffer is being used by the input routine) we
+	 * just null out the name instead of freeing it.
+	 * We could clear it out later, but this situation
+	 * is so rare that it hardly seems worth it.
+	 */
+	if (ap->flag & ALIASINUSE)
+		*ap->name = '\0';
+	else
 	{
-		if (equal(name, ap->name))
-		{
-			/*
-			 * if the alias is currently in use (i.e. its
-			 * buffer is being used by the input routine) we
-			 * just null out the name instead of freeing it.
-			 * We could clear it out later, but this situation
-			 * is so rare that it hardly seems worth it.
-			 */
-			if (ap->flag & ALIASINUSE)
-				*ap->name = '\0';
-			else
-			{
-				INTOFF;
-				*app = ap->next;
-				ckfree(ap->name);
-				ckfree(ap->val);
-				ckfree(ap);
-				INTON;
-			}
-			aliases--;
-			return (0);
-		}
+		INTOFF;
+		hashremove(&atab, &ap->hent);
+		ckfree(ap->name);
+		ckfree(ap->val);
+		ckfree(ap);
+		INTON;
 	}
-	return (1);
+	aliases--;
+	aliasgen++;
+	return (0);
 }
 
 static void
 rmaliases(void)
 {
-	struct alias* ap, *tmp;
-	int32_t i;
+	struct hashent* hp, *next;
+	struct alias* ap;
 	INTOFF;
-	for (i = 0; i < ATABSIZE; i++)
+	for (hp = hashnext(&atab, NULL); hp; hp = next)
 	{
-		ap = atab[i];
-		atab[i] = NULL;
-		while (ap)
-		{
-			ckfree(ap->name);
-			ckfree(ap->val);
-			tmp = ap;
-			ap = ap->next;
-			ckfree(tmp);
-		}
+		next = hashnext(&atab, hp);
+		hashremove(&atab, hp);
+		ap = (struct alias*)hp;
+		ckfree(ap->name);
+		ckfree(ap->val);
+		ckfree(ap);
 	}
 	aliases = 0;
+	aliasgen++;
 	INTON;
 }
 
 struct alias*
 lookupalias(const_cstring_t name, int32_t check)
 {
-	struct alias* ap = *hashalias(name);
-	for (; ap; ap = ap->next)
-	{
-		if (equal(name, ap->name))
-		{
-			if (check && (ap->flag & ALIASINUSE))
-				return (NULL);
-			return (ap);
-		}
-	}
-	return (NULL);
+	struct alias* ap = findalias(name, hashstr(name));
+	if (ap != NULL && check && (ap->flag & ALIASINUSE))
+		return (NULL);
+	return (ap);
 }
 
 static int32_t __cdecl
@@ -175,13 +159,16 @@ printaliases(void)
 {
 	int32_t i, j;
 	struct alias** sorted, *ap;
+	struct hashent* hp;
 	INTOFF;
 	sorted = ckmalloc(aliases * sizeof(*sorted));
 	j = 0;
-	for (i = 0; i < ATABSIZE; i++)
-		for (ap = atab[i]; ap; ap = ap->next)
-			if (*ap->name != '\0')
-				sorted[j++] = ap;
+	for (hp = hashnext(&atab, NULL); hp; hp = hashnext(&atab, hp))
+	{
+		ap = (struct alias*)hp;
+		if (*ap->name != '\0')
+			sorted[j++] = ap;
+	}
 	qsort(sorted, aliases, sizeof(*sorted), comparealiases);
 	for (i = 0; i < aliases; i++)
 	{
@@ -246,12 +233,16 @@ unaliascmd(int32_t argc __unused, cstring_t* argv __unused)
 	return (i);
 }
 
-static struct alias**
-hashalias(const_cstring_t p)
+static struct alias*
+findalias(const_cstring_t name, uint32_t hashval)
 {
-	uint32_t hashval;
-	hashval = *p << 4;
-	while (*p)
-		hashval += *p++;
-	return &atab[hashval % ATABSIZE];
+	struct hashent* hp;
+	struct alias* ap;
+	for (hp = hashfirst(&atab, hashval); hp; hp = hp->next)
+	{
+		ap = (struct alias*)hp;
+		if (hp->hash == hashval && equal(name, ap->name))
+			return (ap);
+	}
+	return (NULL);
 }
@@ -33,14 +33,19 @@
  * $FreeBSD: head/bin/sh/alias.h 223060 2011-06-13 21:03:27Z jilles $
  */
 
+#include "hashtab.h"
+
 #define ALIASINUSE	1
 
 struct alias
 {
-	struct alias* next;
+	struct hashent hent;	/* hash table link, must be first */
 	cstring_t name;
 	cstring_t val;
 	int32_t flag;
 };
 
+extern int32_t aliases;
+extern uint32_t aliasgen;
+
 struct alias* lookupalias(const_cstring_t, int32_t);
@@ -25,6 +25,7 @@ int32_t (*const builtinfunc[])(int32_t, cstring_t*) =
 	exportcmd,
 	falsecmd,
 	fgcmd,
+	forkstatscmd,
 	getoptscmd,
 	hashcmd,
 	histcmd,
@@ -32,6 +33,10 @@ int32_t (*const builtinfunc[])(int32_t, cstring_t*) =
 	jobscmd,
 	killcmd,
 	localcmd,
+	memstatscmd,
+	parsebenchcmd,
+	poolcmd,
+	precompilecmd,
 	printfcmd,
 	pwdcmd,
 	readcmd,
@@ -73,32 +78,57 @@ const struct builtincmd builtincmd[] =
 	{ "readonly", 13, 1 },
 	{ "false", 14, 0 },
 	{ "fg", 15, 0 },
-	{ "getopts", 16, 0 },
-	{ "hash", 17, 0 },
-	{ "fc", 18, 0 },
-	{ "jobid", 19, 0 },
-	{ "jobs", 20, 0 },
-	{ "kill", 21, 0 },
-	{ "local", 22, 0 },
-	{ "printf", 23, 0 },
-	{ "pwd", 24, 0 },
-	{ "read", 25, 0 },
-	{ "return", 26, 1 },
-	{ "set", 27, 1 },
-	{ "setvar", 28, 0 },
-	{ "shift", 29, 1 },
-	{ "test", 30, 0 },
-	{ "[", 30, 0 },
-	{ "times", 31, 1 },
-	{ "trap", 32, 1 },
-	{ ":", 33, 1 },
-	{ "true", 33, 0 },
-	{ "type", 34, 0 },
-	{ "ulimit", 35, 0 },
-	{ "umask", 36, 0 },
-	{ "unalias", 37, 0 },
-	{ "unset", 38, 1 },
-	{ "wait", 39, 0 },
-	{ "wordexp", 40, 0 },
+	{ "forkstats", 16, 0 },
+	{ "getopts", 17, 0 },
+	{ "hash", 18, 0 },
+	{ "fc", 19, 0 },
+	{ "jobid", 20, 0 },
+	{ "jobs", 21, 0 },
+	{ "kill", 22, 0 },
+	{ "local", 23, 0 },
+	{ "memstats", 24, 0 },
+	{ "parsebench", 25, 0 },
+	{ "pool", 26, 0 },
+	{ "precompile", 27, 0 },
+	{ "printf", 28, 0 },
+	{ "pwd", 29, 0 },
+	{ "read", 30, 0 },
+	{ "return", 31, 1 },
+	{ "set", 32, 1 },
+	{ "setvar", 33, 0 },
+	{ "shift", 34, 1 },
+	{ "test", 35, 0 },
+	{ "[", 35, 0 },
+	{ "times", 36, 1 },
+	{ "trap", 37, 1 },
+	{ ":", 38, 1 },
+	{ "true", 38, 0 },
+	{ "type", 39, 0 },
+	{ "ulimit", 40, 0 },
+	{ "umask", 41, 0 },
+	{ "unalias", 42, 0 },
+	{ "unset", 43, 1 },
+	{ "wait", 44, 0 },
+	{ "wordexp", 45, 0 },
 	{ NULL, 0, 0 }
 };
+
+const int8_t builtinhash[] =
+{
+	-1, -1, -1, -1, 6, -1, -1, -1, -1, 18, -1, -1, -1, 33, -1, 34,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, -1, -1, -1, -1,
+	35, -1, 31, 17, -1, -1, -1, -1, -1, -1, -1, 32, 27, 40, -1, -1,
+	20, -1, -1, -1, -1, 2, -1, -1, -1, -1, -1, -1, 28, 42, -1, -1,
+	-1, -1, 46, -1, -1, -1, -1, -1, -1, 25, -1, -1, -1, 7, -1, -1,
+	-1, -1, -1, 24, -1, -1, -1, -1, -1, -1, 37, 50, -1, -1, -1, -1,
+	14, -1, -1, -1, -1, -1, -1, -1, 12, -1, 26, -1, -1, -1, -1, -1,
+	-1, -1, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1, -1,
+	22, -1, -1, -1, -1, -1, -1, -1, 45, -1, -1, -1, -1, -1, 21, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 36, -1, 10,
+	-1, -1, -1, 9, -1, -1, -1, -1, -1, 44, -1, -1, -1, 11, -1, -1,
+	43, 48, -1, -1, 38, 30, 16, -1, -1, -1, 23, -1, -1, -1, -1, -1,
+	13, -1, 3, -1, 47, -1, -1, -1, 41, -1, -1, -1, 19, -1, -1, -1,
+	-1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	4, -1, 49, -1, 39, -1, -1, 5, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 29, -1, -1,
+};
@@ -19,31 +19,39 @@
 #define EXPORTCMD 13
 #define FALSECMD 14
 #define FGCMD 15
-#define GETOPTSCMD 16
-#define HASHCMD 17
-#define HISTCMD 18
-#define JOBIDCMD 19
-#define JOBSCMD 20
-#define KILLCMD 21
-#define LOCALCMD 22
-#define PRINTFCMD 23
-#define PWDCMD 24
-#define READCMD 25
-#define RETURNCMD 26
-#define SETCMD 27
-#define SETVARCMD 28
-#define SHIFTCMD 29
-#define TESTCMD 30
-#define TIMESCMD 31
-#define TRAPCMD 32
-#define TRUECMD 33
-#define TYPECMD 34
-#define ULIMITCMD 35
-#define UMASKCMD 36
-#define UNALIASCMD 37
-#define UNSETCMD 38
-#define WAITCMD 39
-#define WORDEXPCMD 40
+#define FORKSTATSCMD 16
+#define GETOPTSCMD 17
+#define HASHCMD 18
+#define HISTCMD 19
+#define JOBIDCMD 20
+#define JOBSCMD 21
+#define KILLCMD 22
+#define LOCALCMD 23
+#define MEMSTATSCMD 24
+#define PARSEBENCHCMD 25
+#define POOLCMD 26
+#define PRECOMPILECMD 27
+#define PRINTFCMD 28
+#define PWDCMD 29
+#define READCMD 30
+#define RETURNCMD 31
+#define SETCMD 32
+#define SETVARCMD 33
+#define SHIFTCMD 34
+#define TESTCMD 35
+#define TIMESCMD 36
+#define TRAPCMD 37
+#define TRUECMD 38
+#define TYPECMD 39
+#define ULIMITCMD 40
+#define UMASKCMD 41
+#define UNALIASCMD 42
+#define UNSETCMD 43
+#define WAITCMD 44
+#define WORDEXPCMD 45
+
+#define BLTINHASHSEED 40581U
+#define BLTINHASHBITS 8
 
 struct builtincmd
 {
@@ -54,6 +62,7 @@ struct builtincmd
 
 extern int32_t (*const builtinfunc[])(int32_t, cstring_t*);
 extern const struct builtincmd builtincmd[];
+extern const int8_t builtinhash[];
 
 int32_t bltincmd(int32_t, cstring_t*);
 int32_t aliascmd(int32_t, cstring_t*);
@@ -71,6 +80,7 @@ int32_t letcmd(int32_t, cstring_t*);
 int32_t exportcmd(int32_t, cstring_t*);
 int32_t falsecmd(int32_t, cstring_t*);
 int32_t fgcmd(int32_t, cstring_t*);
+int32_t forkstatscmd(int32_t, cstring_t*);
 int32_t getoptscmd(int32_t, cstring_t*);
 int32_t hashcmd(int32_t, cstring_t*);
 int32_t histcmd(int32_t, cstring_t*);
@@ -78,6 +88,10 @@ int32_t jobidcmd(int32_t, cstring_t*);
 int32_t jobscmd(int32_t, cstring_t*);
 int32_t killcmd(int32_t, cstring_t*);
 int32_t localcmd(int32_t, cstring_t*);
+int32_t memstatscmd(int32_t, cstring_t*);
+int32_t parsebenchcmd(int32_t, cstring_t*);
+int32_t poolcmd(int32_t, cstring_t*);
+int32_t precompilecmd(int32_t, cstring_t*);
 int32_t printfcmd(int32_t, cstring_t*);
 int32_t pwdcmd(int32_t, cstring_t*);
 int32_t readcmd(int32_t, cstring_t*);
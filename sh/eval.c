@@ -39,7 +39,9 @@
 #include <unistd.h>
 #include <sys/resource.h>
 #include <sys/wait.h> /* For WIFSIGNALED(status) */
+#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 
 /*
  * Evaluate a command.
@@ -74,6 +76,8 @@ int32_t skipcount;			/* number of levels to skip */
 static int32_t loopnest;		/* current loop nesting level */
 int32_t funcnest;			/* depth of function calls */
 static int32_t builtin_flags;	/* evalcommand flags for builtins */
+static unsigned long nbackshell;	/* command substitutions run in the shell */
+static unsigned long nbackfork;	/* command substitutions that forked */
 
 
 cstring_t commandname;
@@ -84,13 +88,19 @@ int32_t oexitstatus;		/* saved exit status */
 
 static void evalloop(union node*, int32_t);
 static void evalfor(union node*, int32_t);
+static void evalcode(union node*, int32_t);
 static union node* evalcase(union node*);
 static void evalsubshell(union node*, int32_t);
 static void evalredir(union node*, int32_t);
-static void exphere(union node*, struct arglist*);
 static void expredir(union node*);
 static void evalpipe(union node*);
+static int32_t spawnstage(struct job*, union node*, int32_t, int32_t []);
 static int32_t is_valid_fast_cmdsubst(union node* n);
+static int32_t issafecmd(union node*);
+static int32_t issafetree(union node*);
+static void evalbacktree(union node*, pbackcmd_t);
+static int32_t readbackfile(union node*, pbackcmd_t);
+static int32_t safe_builtin(int32_t, int32_t, cstring_t*);
 static void evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd);
 static void prehash(union node*);
 
@@ -253,10 +263,16 @@ evaltree(union node* n, int32_t flags)
 			}
 			case NWHILE:
 			case NUNTIL:
-				evalloop(n, flags & ~EV_EXIT);
+				if (bytecodeflag)
+					evalcode(n, flags & ~EV_EXIT);
+				else
+					evalloop(n, flags & ~EV_EXIT);
 				break;
 			case NFOR:
-				evalfor(n, flags & ~EV_EXIT);
+				if (bytecodeflag)
+					evalcode(n, flags & ~EV_EXIT);
+				else
+					evalfor(n, flags & ~EV_EXIT);
 				break;
 			case NCASE:
 				next = evalcase(n);
@@ -394,6 +410,415 @@ evalfor(union node* n, int32_t flags)
 }
 
 
+/*
+ * The bytecode evaluator.
+ *
+ * With the bytecode option set, a loop is lowered into a flat array of
+ * instructions with explicit jumps, which evalcode() runs in a single
+ * loop instead of recursing through evaltree() for every node.  Lists,
+ * and-or lists, if, !, case and nested loops are lowered; simple commands
+ * are run by evalcommand() and everything else (pipelines, subshells,
+ * redirections, function definitions) is passed to evaltree().  Each
+ * instruction knows where to continue if evalskip is set, so break,
+ * continue and return unwind without recursion.  The program is kept on
+ * the stack while the loop runs.
+ */
+
+#define EVMAXDEPTH	16	/* maximum nesting of for loops */
+#define EVMAXLOOPS	32	/* maximum number of loops in a program */
+
+#define OP_CMD		0	/* evaluate simple command n */
+#define OP_TREE		1	/* evaluate n with evaltree() */
+#define OP_JMP		2	/* jump to arg */
+#define OP_JZ		3	/* jump to arg if exitstatus is zero */
+#define OP_JNZ		4	/* jump to arg if exitstatus is nonzero */
+#define OP_NOT		5	/* negate exitstatus */
+#define OP_STATUS0	6	/* set exitstatus to zero */
+#define OP_LOOP		7	/* enter loop arg */
+#define OP_FOR		8	/* expand the words of for loop n, enter loop arg */
+#define OP_FORNEXT	9	/* assign the next word, or jump to arg2 */
+#define OP_SETSTATUS	10	/* exitstatus becomes the status of loop arg */
+#define OP_LOOPSKIP	11	/* skip in the condition: continue at arg or leave at arg2 */
+#define OP_BODYSKIP	12	/* likewise for a skip in the body */
+#define OP_LOOPEND	13	/* leave loop arg */
+#define OP_CASE		14	/* expand the word of case n and match the arms */
+#define OP_ARM		15	/* patterns of case arm n, body at arg */
+
+struct evinst
+{
+	int16_t op;
+	int16_t depth;		/* for loop nesting; stack mark to restore */
+	int16_t tested;		/* exit status is checked */
+	int32_t arg;
+	int32_t arg2;
+	int32_t skip;		/* next instruction if evalskip is set, or -1 */
+	union node* n;
+};
+
+struct evcomp
+{
+	struct evinst* code;	/* NULL while sizing the program */
+	int32_t ninst;
+	int32_t nloops;
+	int32_t fail;		/* program exceeds the limits */
+};
+
+struct evloop
+{
+	int32_t status;		/* exit status of the loop */
+	struct strlist* list;	/* remaining words of a for loop */
+};
+
+
+static int32_t
+evemit(struct evcomp* c, int32_t op, union node* n, int32_t depth,
+	   int32_t tested, int32_t skip)
+{
+	struct evinst* ip;
+	if (c->code != NULL)
+	{
+		ip = &c->code[c->ninst];
+		ip->op = op;
+		ip->depth = depth;
+		ip->tested = tested;
+		ip->arg = ip->arg2 = 0;
+		ip->skip = skip;
+		ip->n = n;
+	}
+	return c->ninst++;
+}
+
+
+static void
+evsetarg(struct evcomp* c, int32_t i, int32_t arg, int32_t arg2)
+{
+	if (c->code != NULL)
+	{
+		if (arg >= 0)
+			c->code[i].arg = arg;
+		if (arg2 >= 0)
+			c->code[i].arg2 = arg2;
+	}
+}
+
+
+/*
+ * Resolve where a match of each case arm continues, following evalcase():
+ * empty arms ending in ;& lead to the next arm, and a match that selects
+ * no commands sets the exit status to zero.
+ */
+
+static void
+evcasearms(struct evcomp* c, int32_t first, int32_t zero)
+{
+	struct evinst* ap;
+	struct evinst* bp;
+	union node* cp;
+	if (c->code == NULL)
+		return;
+	for (ap = &c->code[first] ; ap->n != NULL ; ap++)
+	{
+		for (bp = ap ; (cp = bp->n)->nclist.next != NULL &&
+				cp->type == NCLISTFALLTHRU && cp->nclist.body == NULL ; bp++)
+			continue;
+		if ((cp->nclist.next == NULL || cp->type != NCLISTFALLTHRU) &&
+				cp->nclist.body == NULL)
+			ap->arg2 = zero;
+		else
+			ap->arg2 = bp->arg;
+	}
+	for (ap = &c->code[first] ; ap->n != NULL ; ap++)
+		ap->arg = ap->arg2;
+	ap->arg = zero;
+}
+
+
+static void
+evlower(struct evcomp* c, union node* n, int32_t depth, int32_t tested,
+		int32_t skip)
+{
+	union node* cp;
+	int32_t slot;
+	int32_t first;
+	int32_t top;
+	int32_t end;
+	int32_t hc;
+	int32_t hb;
+	int32_t i;
+	int32_t j;
+	if (n == NULL)
+	{
+		evemit(c, OP_STATUS0, n, depth, tested, skip);
+		return;
+	}
+	switch (n->type)
+	{
+		case NSEMI:
+			evlower(c, n->nbinary.ch1, depth, tested, skip);
+			evlower(c, n->nbinary.ch2, depth, tested, skip);
+			break;
+		case NAND:
+		case NOR:
+			evlower(c, n->nbinary.ch1, depth, 1, skip);
+			i = evemit(c, n->type == NAND ? OP_JNZ : OP_JZ, n, depth,
+					   tested, skip);
+			evlower(c, n->nbinary.ch2, depth, tested, skip);
+			evsetarg(c, i, c->ninst, -1);
+			break;
+		case NIF:
+			evlower(c, n->nif.test, depth, 1, skip);
+			i = evemit(c, OP_JNZ, n, depth, tested, skip);
+			evlower(c, n->nif.ifpart, depth, tested, skip);
+			j = evemit(c, OP_JMP, n, depth, tested, skip);
+			evsetarg(c, i, c->ninst, -1);
+			evlower(c, n->nif.elsepart, depth, tested, skip);
+			evsetarg(c, j, c->ninst, -1);
+			break;
+		case NNOT:
+			evlower(c, n->nnot.com, depth, 1, skip);
+			evemit(c, OP_NOT, n, depth, tested, skip);
+			break;
+		case NWHILE:
+		case NUNTIL:
+			if ((slot = c->nloops++) >= EVMAXLOOPS)
+				c->fail = 1;
+			/* The skip handlers go first, so the body can refer to them. */
+			i = evemit(c, OP_LOOP, n, depth, tested, skip);
+			evsetarg(c, i, slot, -1);
+			j = evemit(c, OP_JMP, n, depth, tested, skip);
+			hc = evemit(c, OP_LOOPSKIP, n, depth, tested, -1);
+			hb = evemit(c, OP_BODYSKIP, n, depth, tested, -1);
+			top = c->ninst;
+			evlower(c, n->nbinary.ch1, depth, 1, hc);
+			i = evemit(c, n->type == NWHILE ? OP_JNZ : OP_JZ, n, depth,
+					   tested, hc);
+			evlower(c, n->nbinary.ch2, depth, tested, hb);
+			evsetarg(c, evemit(c, OP_SETSTATUS, n, depth, tested, hb),
+					 slot, -1);
+			evsetarg(c, evemit(c, OP_JMP, n, depth, tested, hb), top, -1);
+			end = evemit(c, OP_LOOPEND, n, depth, tested, skip);
+			evsetarg(c, end, slot, -1);
+			evsetarg(c, j, top, -1);
+			evsetarg(c, i, end, -1);
+			if (c->code != NULL)
+			{
+				c->code[hc].arg = c->code[hb].arg = slot;
+				c->code[hc].arg2 = c->code[hb].arg2 = top;
+				c->code[hc].skip = c->code[hb].skip = end;
+			}
+			break;
+		case NFOR:
+			if ((slot = c->nloops++) >= EVMAXLOOPS || depth + 1 >= EVMAXDEPTH)
+				c->fail = 1;
+			evsetarg(c, evemit(c, OP_FOR, n, depth, tested, skip), slot, -1);
+			j = evemit(c, OP_JMP, n, depth, tested, skip);
+			hb = evemit(c, OP_BODYSKIP, n, depth, tested, -1);
+			top = evemit(c, OP_FORNEXT, n, depth + 1, tested, hb);
+			evlower(c, n->nfor.body, depth + 1, tested, hb);
+			evsetarg(c, evemit(c, OP_SETSTATUS, n, depth + 1, tested, hb),
+					 slot, -1);
+			evsetarg(c, evemit(c, OP_JMP, n, depth + 1, tested, hb), top, -1);
+			end = evemit(c, OP_LOOPEND, n, depth, tested, skip);
+			evsetarg(c, end, slot, -1);
+			evsetarg(c, j, top, -1);
+			evsetarg(c, top, slot, end);
+			if (c->code != NULL)
+			{
+				c->code[hb].arg = slot;
+				c->code[hb].arg2 = top;
+				c->code[hb].skip = end;
+			}
+			break;
+		case NCASE:
+			evemit(c, OP_CASE, n, depth, tested, skip);
+			first = c->ninst;
+			for (cp = n->ncase.cases ; cp != NULL ; cp = cp->nclist.next)
+				evemit(c, OP_ARM, cp, depth, tested, skip);
+			evemit(c, OP_ARM, NULL, depth, tested, skip);
+			/*
+			 * The bodies follow in order, so that ;& falls through to
+			 * the next one.  The arms temporarily hold their body.
+			 */
+			i = first;
+			for (cp = n->ncase.cases ; cp != NULL ; cp = cp->nclist.next)
+			{
+				evsetarg(c, i++, c->ninst, -1);
+				if (cp->nclist.body != NULL)
+					evlower(c, cp->nclist.body, depth, tested, skip);
+				if (cp->type != NCLISTFALLTHRU || cp->nclist.next == NULL)
+					evemit(c, OP_JMP, cp, depth, tested, skip);
+			}
+			i = evemit(c, OP_STATUS0, n, depth, tested, skip);
+			end = c->ninst;
+			evcasearms(c, first, i);
+			if (c->code != NULL)
+				for (j = first ; j < i ; j++)
+					if (c->code[j].op == OP_JMP)
+						c->code[j].arg = end;
+			break;
+		case NCMD:
+			evemit(c, OP_CMD, n, depth, tested, skip);
+			break;
+		default:
+			evemit(c, OP_TREE, n, depth, tested, skip);
+			break;
+	}
+}
+
+
+/*
+ * Evaluate a loop with the bytecode evaluator.
+ */
+
+static void
+evalcode(union node* n, int32_t flags)
+{
+	struct evcomp c;
+	struct evinst* code;
+	struct evinst* ip;
+	struct evinst* ap;
+	struct stackmark marks[EVMAXDEPTH];
+	struct evloop loops[EVMAXLOOPS];
+	struct arglist arglist;
+	struct strlist* sp;
+	union node* argp;
+	int32_t tested;
+	int32_t pc;
+	tested = (flags & EV_TESTED) != 0;
+	memset(&c, 0, sizeof(c));
+	evlower(&c, n, 0, tested, -1);
+	if (c.fail)
+	{
+		if (n->type == NFOR)
+			evalfor(n, flags);
+		else
+			evalloop(n, flags);
+		return;
+	}
+	code = stalloc(c.ninst * sizeof(*code));
+	c.code = code;
+	c.ninst = c.nloops = 0;
+	evlower(&c, n, 0, tested, -1);
+	setstackmark(&marks[0]);
+	pc = 0;
+	while (pc >= 0 && pc < c.ninst)
+	{
+		ip = &code[pc++];
+		switch (ip->op)
+		{
+			case OP_CMD:
+			case OP_TREE:
+#ifndef NO_HISTORY
+				displayhist = 1;
+#endif
+				if (ip->op == OP_CMD)
+					evalcommand(ip->n, ip->tested ? EV_TESTED : flags,
+								(pbackcmd_t)NULL);
+				else
+					evaltree(ip->n, ip->tested ? EV_TESTED : flags);
+				popstackmark(&marks[ip->depth]);
+				setstackmark(&marks[ip->depth]);
+				if (ip->op == OP_CMD)
+				{
+					if (pendingsig)
+						dotrap();
+					if (eflag && exitstatus != 0 && !ip->tested)
+						exitshell(exitstatus);
+				}
+				break;
+			case OP_JMP:
+				pc = ip->arg;
+				break;
+			case OP_JZ:
+				if (exitstatus == 0)
+					pc = ip->arg;
+				break;
+			case OP_JNZ:
+				if (exitstatus != 0)
+					pc = ip->arg;
+				break;
+			case OP_NOT:
+				exitstatus = !exitstatus;
+				break;
+			case OP_STATUS0:
+				exitstatus = 0;
+				break;
+			case OP_LOOP:
+				loopnest++;
+				loops[ip->arg].status = 0;
+				break;
+			case OP_FOR:
+				arglist.lastp = &arglist.list;
+				for (argp = ip->n->nfor.args ; argp ; argp = argp->narg.next)
+				{
+					oexitstatus = exitstatus;
+					expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+				}
+				*arglist.lastp = NULL;
+				loops[ip->arg].list = arglist.list;
+				loops[ip->arg].status = 0;
+				loopnest++;
+				setstackmark(&marks[ip->depth + 1]);
+				break;
+			case OP_FORNEXT:
+				if ((sp = loops[ip->arg].list) == NULL)
+				{
+					pc = ip->arg2;
+					break;
+				}
+				loops[ip->arg].list = sp->next;
+				setvar(ip->n->nfor.var, sp->text, 0);
+				break;
+			case OP_SETSTATUS:
+				loops[ip->arg].status = exitstatus;
+				break;
+			case OP_LOOPSKIP:
+			case OP_BODYSKIP:
+				if (ip->op == OP_BODYSKIP)
+					loops[ip->arg].status = exitstatus;
+				if (evalskip == SKIPCONT && --skipcount <= 0)
+				{
+					evalskip = 0;
+					pc = ip->arg2;
+					break;
+				}
+				if (evalskip == SKIPBREAK && --skipcount <= 0)
+					evalskip = 0;
+				if (evalskip == SKIPRETURN)
+					loops[ip->arg].status = exitstatus;
+				pc = ip->skip;
+				break;
+			case OP_LOOPEND:
+				loopnest--;
+				exitstatus = loops[ip->arg].status;
+				popstackmark(&marks[ip->depth]);
+				setstackmark(&marks[ip->depth]);
+				break;
+			case OP_CASE:
+				arglist.lastp = &arglist.list;
+				oexitstatus = exitstatus;
+				expandarg(ip->n->ncase.expr, &arglist, EXP_TILDE);
+				for (ap = ip + 1 ; ap->n != NULL ; ap++)
+				{
+					for (argp = ap->n->nclist.pattern ; argp ;
+							argp = argp->narg.next)
+						if (casematch(argp, arglist.list->text))
+							break;
+					if (argp != NULL)
+						break;
+				}
+				pc = ap->arg;
+				popstackmark(&marks[ip->depth]);
+				setstackmark(&marks[ip->depth]);
+				break;
+		}
+		if (evalskip)
+			pc = ip->skip;
+	}
+	popstackmark(&marks[0]);
+}
+
+
 /*
  * Evaluate a case statement, returning the selected tree.
  *
@@ -509,37 +934,6 @@ evalredir(union node* n, int32_t flags)
 }
 
 
-static void
-exphere(union node* redir, struct arglist* fn)
-{
-	struct jmploc jmploc;
-	struct jmploc* savehandler;
-	struct localvar* savelocalvars;
-	int32_t need_longjmp = 0;
-	redir->nhere.expdoc = nullstr;
-	savelocalvars = localvars;
-	localvars = NULL;
-	forcelocal++;
-	savehandler = handler;
-	if (setjmp(jmploc.loc))
-		need_longjmp = exception != EXERROR && exception != EXEXEC;
-	else
-	{
-		handler = &jmploc;
-		expandarg(redir->nhere.doc, fn, 0);
-		redir->nhere.expdoc = fn->list->text;
-		INTOFF;
-	}
-	handler = savehandler;
-	forcelocal--;
-	poplocalvars();
-	localvars = savelocalvars;
-	if (need_longjmp)
-		longjmp(handler->loc, 1);
-	INTON;
-}
-
-
 /*
  * Compute the names of the files in a redirection list.
  */
@@ -570,9 +964,6 @@ expredir(union node* n)
 					fixredir(redir, fn.list->text, 1);
 				}
 				break;
-			case NXHERE:
-				exphere(redir, &fn);
-				break;
 		}
 	}
 }
@@ -614,7 +1005,9 @@ evalpipe(union node* n)
 				sherror("Pipe call failed: %s", strerror(errno));
 			}
 		}
-		if (forkshell(jp, lp->n, n->npipe.backgnd) == 0)
+		if ((n->npipe.backgnd ||
+				!spawnstage(jp, lp->n, prevfd, lp->next ? pip : NULL)) &&
+				forkshell(jp, lp->n, n->npipe.backgnd) == 0)
 		{
 			INTON;
 			if (prevfd > 0)
@@ -654,12 +1047,400 @@ evalpipe(union node* n)
 
 
 
+/*
+ * Return true if expanding the text can neither change the state of the
+ * shell nor fail, so that it gives the same result in the parent as in a
+ * forked child: no command substitutions, arithmetic, ${var=word},
+ * ${var?word}, $! or set -u.
+ */
+
+static int32_t
+ispureword(const_cstring_t p)
+{
+	int32_t subtype;
+	if (uflag)
+		return 0;
+	for (; *p != '\0' ; p++)
+	{
+		switch (*p)
+		{
+			case CTLESC:
+				p++;
+				break;
+			case CTLBACKQ:
+			case CTLBACKQ | CTLQUOTE:
+			case CTLARI:
+				return 0;
+			case CTLVAR:
+				subtype = *++p & VSTYPE;
+				if (subtype == VSASSIGN || subtype == VSQUESTION ||
+						subtype == VSERROR || p[1] == '!')
+					return 0;
+				break;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * Start a pipeline stage that is a plain external command without forking
+ * the shell.  The words are expanded here, which is only done if that has
+ * no side effects, and the command is started by spawnshell() or
+ * vforkexecshell() with the pipe already in place.  Returns false if the
+ * stage must be run in a forked subshell.
+ */
+
+static int32_t
+spawnstage(struct job* jp, union node* n, int32_t prevfd, int32_t pip[])
+{
+	union node* argp;
+	union node* redir;
+	struct arglist arglist;
+	struct arglist varlist;
+	struct cmdentry entry;
+	struct strlist* sp;
+	cstring_t* argv;
+	cstring_t* envp;
+	const_cstring_t path;
+	int32_t argc;
+	if (n->type != NCMD || forkmode == FORKMODE_FORK || disvforkset() ||
+			xflag)
+		return 0;
+	if (forkmode == FORKMODE_VFORK &&
+			(n->ncmd.redirect != NULL || iflag || mflag))
+		return 0;
+	for (argp = n->ncmd.args ; argp ; argp = argp->narg.next)
+		if (!argp->narg.literal && !ispureword(argp->narg.text))
+			return 0;
+	for (redir = n->ncmd.redirect ; redir ; redir = redir->nfile.next)
+	{
+		if (redir->type == NHERE || redir->type == NXHERE ||
+				((redir->type == NTOFD || redir->type == NFROMFD) &&
+				 redir->ndup.vname != NULL))
+			return 0;
+		if (redir->type != NTOFD && redir->type != NFROMFD &&
+				!redir->nfile.fname->narg.literal &&
+				!ispureword(redir->nfile.fname->narg.text))
+			return 0;
+	}
+	oexitstatus = exitstatus;
+	arglist.lastp = &arglist.list;
+	varlist.lastp = &varlist.list;
+	for (argp = n->ncmd.args ; argp ; argp = argp->narg.next)
+	{
+		if (arglist.lastp == &arglist.list &&
+				isassignment(argp->narg.text))
+			expandarg(argp, &varlist, EXP_VARTILDE);
+		else
+			expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+	}
+	*arglist.lastp = NULL;
+	*varlist.lastp = NULL;
+	if (arglist.list == NULL)
+		return 0;
+	/*
+	 * A PATH= assignment changes where the command is looked up and
+	 * needs the hash table cleared around it, see evalcommand().
+	 */
+	for (sp = varlist.list ; sp ; sp = sp->next)
+		if (strncmp(sp->text, "PATH=", 5) == 0)
+			return 0;
+	path = pathval();
+	find_command(arglist.list->text, &entry, 0, path);
+	if (entry.cmdtype != CMDNORMAL)
+		return 0;
+	argc = 0;
+	for (sp = arglist.list ; sp ; sp = sp->next)
+		argc++;
+	/* Add one slot at the beginning for tryexec(). */
+	argv = stalloc(sizeof(cstring_t) * (argc + 2));
+	argv++;
+	for (sp = arglist.list ; sp ; sp = sp->next)
+		*argv++ = sp->text;
+	*argv = NULL;
+	argv -= argc;
+	if (forkmode == FORKMODE_SPAWN)
+	{
+		expredir(n->ncmd.redirect);
+		if ((envp = cmdenvironment(varlist.list)) == NULL)
+			return 0;
+		return spawnshell(jp, n, argv, envp, path, entry.u.index, FORK_FG,
+						  prevfd, pip) != -1;
+	}
+	if (varlist.list != NULL)
+		return 0;
+	vforkexecshell(jp, argv, environment(), path, entry.u.index, prevfd,
+				   pip);
+	return 1;
+}
+
+
+
+/*
+ * Check if a command substitution can be run without forking.  A simple
+ * command is always tried here; evalcommand() forks it if it is not a safe
+ * builtin.  Lists, conditionals and pipelines are only run in the shell if
+ * every command in them is known beforehand to be a safe builtin whose
+ * words can be expanded without side effects, because by the time one of
+ * them turned out to need a subshell the others would already have run.
+ * With set -e a failing command would exit the shell itself, so these are
+ * left to a subshell as well.
+ */
+
 static int32_t
 is_valid_fast_cmdsubst(union node* n)
 {
-	return (n->type == NCMD);
+	if (n->type == NCMD)
+		return 1;
+	return (!eflag && issafetree(n));
+}
+
+
+static int32_t
+issafetree(union node* n)
+{
+	struct nodelist* lp;
+	if (n == NULL)
+		return 1;
+	switch (n->type)
+	{
+		case NCMD:
+			return issafecmd(n);
+		case NSEMI:
+		case NAND:
+		case NOR:
+			return (issafetree(n->nbinary.ch1) && issafetree(n->nbinary.ch2));
+		case NIF:
+			return (issafetree(n->nif.test) && issafetree(n->nif.ifpart) &&
+					issafetree(n->nif.elsepart));
+		case NNOT:
+			return issafetree(n->nnot.com);
+		case NPIPE:
+			if (n->npipe.backgnd)
+				return 0;
+			for (lp = n->npipe.cmdlist ; lp ; lp = lp->next)
+				if (!issafecmd(lp->n))
+					return 0;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+/*
+ * Check if a simple command is a safe builtin without expanding it.  The
+ * command name must be a literal word that is not overridden by a function;
+ * builtin and command are refused since they run some other command.  If
+ * all the arguments are literal safe_builtin() can look at them, otherwise
+ * only the builtins that are safe with any arguments are accepted.
+ */
+
+static int32_t
+issafecmd(union node* n)
+{
+	union node* argp;
+	union node* redir;
+	cstring_t argv[3];
+	int32_t argc;
+	int32_t idx;
+	int32_t special;
+	if (n->type != NCMD || n->ncmd.args == NULL ||
+			!n->ncmd.args->narg.literal ||
+			isassignment(n->ncmd.args->narg.text))
+		return 0;
+	argc = 0;
+	for (argp = n->ncmd.args ; argp ; argp = argp->narg.next)
+	{
+		if (!argp->narg.literal && !ispureword(argp->narg.text))
+			return 0;
+		if (argc < 3)
+			argv[argc] = argp->narg.text;
+		argc = argp->narg.literal && argc < 3 ? argc + 1 : 3;
+	}
+	for (redir = n->ncmd.redirect ; redir ; redir = redir->nfile.next)
+	{
+		if (redir->type == NHERE || redir->type == NXHERE ||
+				((redir->type == NTOFD || redir->type == NFROMFD) &&
+				 redir->ndup.vname != NULL))
+			return 0;
+		if (redir->type != NTOFD && redir->type != NFROMFD &&
+				!redir->nfile.fname->narg.literal &&
+				!ispureword(redir->nfile.fname->narg.text))
+			return 0;
+	}
+	idx = find_builtin(argv[0], &special);
+	if (idx < 0 || idx == BLTINCMD || idx == COMMANDCMD ||
+			isfunc(argv[0]))
+		return 0;
+	return safe_builtin(idx, argc, argv);
 }
 
+
+/*
+ * Run a list, conditional or pipeline accepted by issafetree() in the
+ * shell, appending the output of each command to result->buf.  Only the
+ * last command of a pipeline produces output that is kept, as the safe
+ * builtins do not read their standard input.
+ */
+
+static void
+evalbacktree(union node* n, pbackcmd_t result)
+{
+	struct backcmd cmd;
+	struct nodelist* lp;
+	if (n == NULL)
+		return;
+	switch (n->type)
+	{
+		case NSEMI:
+			evalbacktree(n->nbinary.ch1, result);
+			evalbacktree(n->nbinary.ch2, result);
+			break;
+		case NAND:
+			evalbacktree(n->nbinary.ch1, result);
+			if (exitstatus == 0)
+				evalbacktree(n->nbinary.ch2, result);
+			break;
+		case NOR:
+			evalbacktree(n->nbinary.ch1, result);
+			if (exitstatus != 0)
+				evalbacktree(n->nbinary.ch2, result);
+			break;
+		case NIF:
+			evalbacktree(n->nif.test, result);
+			if (exitstatus == 0)
+				evalbacktree(n->nif.ifpart, result);
+			else if (n->nif.elsepart)
+				evalbacktree(n->nif.elsepart, result);
+			else
+				exitstatus = 0;
+			break;
+		case NNOT:
+			evalbacktree(n->nnot.com, result);
+			exitstatus = !exitstatus;
+			break;
+		case NPIPE:
+			for (lp = n->npipe.cmdlist ; lp->next ; lp = lp->next)
+			{
+				cmd.buf = NULL;
+				cmd.nleft = 0;
+				evalcommand(lp->n, EV_BACKCMD, &cmd);
+				if (cmd.buf)
+					ckfree(cmd.buf);
+			}
+			evalbacktree(lp->n, result);
+			break;
+		case NCMD:
+			if (result->buf == NULL)
+			{
+				evalcommand(n, EV_BACKCMD, result);
+				break;
+			}
+			cmd.buf = NULL;
+			cmd.nleft = 0;
+			evalcommand(n, EV_BACKCMD, &cmd);
+			if (cmd.nleft > 0)
+			{
+				result->buf = ckrealloc(result->buf,
+										result->nleft + cmd.nleft);
+				memcpy(result->buf + result->nleft, cmd.buf, cmd.nleft);
+				result->nleft += cmd.nleft;
+			}
+			if (cmd.buf)
+				ckfree(cmd.buf);
+			break;
+	}
+}
+
+
+
+/*
+ * Handle $(<file) and $(cat file) by reading the file in the shell.  The
+ * first is a command without words whose only redirection reads a file
+ * on standard input; the second is cat, found in the path, with a single
+ * operand and no redirections.  A regular file is read into result->buf
+ * in one go; the descriptor is passed on as well so that anything
+ * appended meanwhile, or the contents of a file that does not report its
+ * size, is still read by expbackq().  Returns false if the command must be
+ * run normally.
+ */
+
+static int32_t
+readbackfile(union node* n, pbackcmd_t result)
+{
+	union node* argp;
+	union node* redir;
+	struct arglist arglist;
+	struct cmdentry entry;
+	struct stat statb;
+	const_cstring_t name;
+	ssize_t nread;
+	int32_t iscat;
+	int32_t fd;
+	if (xflag)
+		return 0;
+	argp = n->ncmd.args;
+	redir = n->ncmd.redirect;
+	if (argp == NULL && redir != NULL && redir->type == NFROM &&
+			redir->nfile.fd == 0 && redir->nfile.next == NULL)
+	{
+		iscat = 0;
+		argp = redir->nfile.fname;
+	}
+	else if (argp != NULL && redir == NULL && argp->narg.literal &&
+			 strcmp(argp->narg.text, "cat") == 0 &&
+			 argp->narg.next != NULL && argp->narg.next->narg.next == NULL &&
+			 (argp->narg.next->narg.literal ||
+			  ispureword(argp->narg.next->narg.text)))
+	{
+		find_command(argp->narg.text, &entry, 0, pathval());
+		if (entry.cmdtype != CMDNORMAL)
+			return 0;
+		iscat = 1;
+		argp = argp->narg.next;
+	}
+	else
+		return 0;
+	arglist.lastp = &arglist.list;
+	expandarg(argp, &arglist, iscat ? EXP_FULL | EXP_TILDE :
+			  EXP_TILDE | EXP_REDIR);
+	*arglist.lastp = NULL;
+	if (iscat && (arglist.list == NULL || arglist.list->next != NULL ||
+				  arglist.list->text[0] == '-'))
+		return 0;
+	name = arglist.list->text;
+	exitstatus = 0;
+	if ((fd = open(name, O_RDONLY)) < 0)
+	{
+		if (!iscat)
+			sherror("cannot open %s: %s", name, strerror(errno));
+		out2fmt_flush("cat: %s: %s\n", name, strerror(errno));
+		exitstatus = 1;
+		return 1;
+	}
+	if (fstat(fd, &statb) < 0)
+		statb.st_mode = 0;
+	if (iscat && S_ISDIR(statb.st_mode))
+	{
+		close(fd);
+		out2fmt_flush("cat: %s: %s\n", name, strerror(EISDIR));
+		exitstatus = 1;
+		return 1;
+	}
+	if (S_ISREG(statb.st_mode) && statb.st_size > 0)
+	{
+		result->buf = ckmalloc(statb.st_size);
+		while ((nread = read(fd, result->buf, statb.st_size)) < 0 &&
+				errno == EINTR);
+		result->nleft = nread > 0 ? nread : 0;
+	}
+	result->fd = fd;
+	return 1;
+}
+
+
 /*
  * Execute a command inside back quotes.  If it's a builtin command, we
  * want to save its output in a block obtained from malloc.  Otherwise
@@ -704,21 +1485,32 @@ evalbackcmd(union node* n, pbackcmd_t result)
 				forcelocal--;
 				poplocalvars();
 				localvars = savelocalvars;
+				if (result->buf)
+					ckfree(result->buf);
+				result->buf = NULL;
 				longjmp(handler->loc, 1);
 			}
 		}
 		else
 		{
 			handler = &jmploc;
-			evalcommand(n, EV_BACKCMD, result);
+			if (n->type != NCMD)
+				evalbacktree(n, result);
+			else if (!readbackfile(n, result))
+				evalcommand(n, EV_BACKCMD, result);
 		}
 		handler = savehandler;
 		forcelocal--;
 		poplocalvars();
 		localvars = savelocalvars;
+		if (result->jp == NULL)
+			nbackshell++;
+		else
+			nbackfork++;
 	}
 	else
 	{
+		nbackfork++;
 		if (pipe((int32_t*)pip) < 0)
 			sherror("Pipe call failed: %s", strerror(errno));
 		jp = makejob(n, 1);
@@ -892,6 +1684,7 @@ evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd)
 	cstring_t lastarg;
 	int32_t realstatus;
 	int32_t do_clearcmdentry;
+	union node* cmdarg;
 	const_cstring_t path = pathval();
 
 	/* First expand the arguments. */
@@ -899,6 +1692,7 @@ evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd)
 	arglist.lastp = &arglist.list;
 	varlist.lastp = &varlist.list;
 	varflag = 1;
+	cmdarg = NULL;
 	jp = NULL;
 	do_clearcmdentry = 0;
 	oexitstatus = exitstatus;
@@ -912,7 +1706,10 @@ evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd)
 			continue;
 		}
 		else if (varflag == 1)
+		{
 			varflag = isdeclarationcmd(&argp->narg) ? 2 : 0;
+			cmdarg = argp;
+		}
 		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
 	}
 	*arglist.lastp = NULL;
@@ -991,6 +1788,9 @@ evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd)
 					break;
 				}
 			}
+			else if (cmd_flags == 0 && cmdarg != NULL &&
+					 cmdarg->narg.literal && path == pathval())
+				find_command_node(cmd, argv[0], &cmdentry);
 			else
 				find_command(argv[0], &cmdentry, cmd_flags, path);
 			/* implement the bltin and command builtins here */
@@ -1072,14 +1872,21 @@ evalcommand(union node* cmd, uint32_t flags, pbackcmd_t backcmd)
 			if (pipe(pip) < 0)
 				sherror("Pipe call failed: %s", strerror(errno));
 		}
+		if (cmdentry.cmdtype == CMDNORMAL &&
+				forkmode == FORKMODE_SPAWN && !disvforkset() &&
+				(envp = cmdenvironment(varlist.list)) != NULL &&
+				spawnshell(jp, cmd, argv, envp, path, cmdentry.u.index,
+						   mode, -1, flags & EV_BACKCMD ? pip : NULL) != -1)
+			goto parent;
 		if (cmdentry.cmdtype == CMDNORMAL &&
 				cmd->ncmd.redirect == NULL &&
 				varlist.list == NULL &&
 				(mode == FORK_FG || mode == FORK_NOJOB) &&
+				forkmode == FORKMODE_VFORK &&
 				!disvforkset() && !iflag && !mflag)
 		{
 			vforkexecshell(jp, argv, environment(), path,
-						   cmdentry.u.index, flags & EV_BACKCMD ? pip : NULL);
+						   cmdentry.u.index, -1, flags & EV_BACKCMD ? pip : NULL);
 			goto parent;
 		}
 		if (forkshell(jp, cmd, mode) != 0)
@@ -1477,3 +2284,25 @@ timescmd(int32_t argc __unused, cstring_t* argv __unused)
 			shusecs, shsmins, shssecs, chumins, chusecs, chsmins, chssecs);
 	return 0;
 }
+
+
+/*
+ * The forkstats builtin: report how many command substitutions were run
+ * in the shell itself and how many needed a subshell.
+ */
+
+int32_t
+forkstatscmd(int32_t argc __unused, cstring_t* argv __unused)
+{
+	int32_t reset;
+	(void)argc; (void)argv;
+
+	reset = 0;
+	while (nextopt("r") != '\0')
+		reset = 1;
+	out1fmt("%-18s %10lu\n", "cmdsubst in shell", nbackshell);
+	out1fmt("%-18s %10lu\n", "cmdsubst forked", nbackfork);
+	if (reset)
+		nbackshell = nbackfork = 0;
+	return 0;
+}
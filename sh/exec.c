@@ -36,17 +36,29 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <errno.h>
 #include <paths.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#define PATHWATCH		/* let inotify tell when a PATH directory changes */
+#endif
+#ifdef __INTERIX
+#include <ctype.h>
+#define PATHDIRFOLD		/* file names may not be case sensitive */
+#endif
 
 /*
  * When commands are first encountered, they are entered in a hash table.
  * This ensures that a full path search will not have to be done for them
- * on each invocation.
+ * on each invocation.  The table doubles in size as it fills.
  *
- * We should investigate converting to a linear search, even though that
- * would make the command name "hash" a misnomer.
+ * The path search itself works from snapshots of the directories in PATH
+ * (see getpathdir), so that it need not stat() a file in every directory
+ * that does not contain the command.
  */
 
 #include "shell.h"
@@ -63,6 +75,7 @@
 #include "output.h"
 #include "syntax.h"
 #include "memalloc.h"
+#include "hashtab.h"
 #include "sherror.h"
 #include "mystring.h"
 #include "show.h"
@@ -72,13 +85,13 @@
 //extern int32_t __cdecl access(const_cstring_t path, int32_t mode);
 //extern int32_t __cdecl eaccess(const_cstring_t path, int32_t mode);	// nonstandard
 
-#define CMDTABLESIZE 31		/* should be prime */
+#define PATHDIRMAX 64		/* directory snapshots kept */
 
 
 
 typedef struct tblentry
 {
-	struct tblentry*	next;		/* next entry in hash chain */
+	struct hashent		hent;		/* hash table link, must be first */
 	union param			param;		/* definition of builtin function */
 	int32_t				special;	/* flag for special builtin commands */
 	uint32_t			cmdtype;	/* index identifying command */
@@ -86,8 +99,44 @@ typedef struct tblentry
 } tblentry_t;
 typedef tblentry_t* ptblentry_t;
 
-static ptblentry_t cmdtable[CMDTABLESIZE];
+/* values of pathdir.state */
+#define PD_STALE	0	/* must be checked before use */
+#define PD_LIST		1	/* names lists the directory */
+#define PD_ABSENT	2	/* the directory does not exist */
+#define PD_UNLISTED	3	/* the directory cannot be read */
+
+/* results of pathdirhas() */
+#define PD_NOTFOUND	0	/* not in the directory */
+#define PD_FOUND	1	/* in the directory */
+#define PD_REGULAR	2	/* in the directory, known to be a regular file */
+#define PD_REGBIT	0x80000000U	/* marks regular files in pathdir.tab */
+
+struct pathdir
+{
+	struct pathdir*	next;
+	cstring_t		dir;		/* name of the directory */
+	size_t			dirlen;
+	int32_t			state;
+	int32_t			wd;			/* inotify watch, or -1 */
+	dev_t			dev;
+	ino_t			ino;
+	time_t			mtime;		/* modification time when read */
+	time_t			readtime;	/* when it was read */
+	time_t			checked;	/* when it was last found current */
+	uint32_t		tabmask;	/* size of tab minus one */
+	uint32_t*		tab;		/* offsets into names plus one, or 0 */
+	cstring_t		names;		/* flag byte, name, NUL; repeated */
+};
+
+static struct pathdir* pathdirs;	/* oldest first */
+static int32_t npathdirs;
+#ifdef PATHWATCH
+static int32_t pathwatchfd = -1;	/* inotify instance, -2 if none */
+#endif
+
+static struct hashtab cmdtable = HASHTAB_INIT(MT_CMDHASH);
 static int32_t cmdtable_cd = 0;	/* cmdtable contains cd-dependent entries */
+uint32_t cmdgen = 1;			/* changes when an entry changes */
 int32_t exerrno = 0;			/* Last exec error */
 
 
@@ -96,6 +145,15 @@ static void printentry(ptblentry_t, int32_t);
 static ptblentry_t cmdlookup(const_cstring_t, int32_t);
 static void delete_cmd_entry(void);
 static void addcmdentry(const_cstring_t, struct cmdentry*);
+static void clearcmdentries(int32_t);
+static void cmdchanged(void);
+static void clearpathdirs(void);
+static struct pathdir* getpathdir(const_cstring_t, size_t, time_t, int32_t,
+								  int32_t*);
+static int32_t pathdirhas(struct pathdir*, const_cstring_t);
+#ifdef PATHWATCH
+static void pathwatchevents(void);
+#endif
 
 
 
@@ -231,7 +289,7 @@ padvance(const_cstring_t* path, const_cstring_t name)
 int32_t
 hashcmd(int32_t argc __unused, cstring_t* argv __unused)
 {
-	ptblentry_t* pp;
+	struct hashent* hp;
 	ptblentry_t cmdp;
 	int32_t c;
 	int32_t verbose;
@@ -247,6 +305,7 @@ hashcmd(int32_t argc __unused, cstring_t* argv __unused)
 		if (c == 'r')
 		{
 			clearcmdentry();
+			clearpathdirs();
 		}
 		else if (c == 'v')
 		{
@@ -255,13 +314,11 @@ hashcmd(int32_t argc __unused, cstring_t* argv __unused)
 	}
 	if (*argptr == NULL)
 	{
-		for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++)
+		for (hp = hashnext(&cmdtable, NULL) ; hp ; hp = hashnext(&cmdtable, hp))
 		{
-			for (cmdp = *pp ; cmdp ; cmdp = cmdp->next)
-			{
-				if (cmdp->cmdtype == CMDNORMAL)
-					printentry(cmdp, verbose);
-			}
+			cmdp = (ptblentry_t)hp;
+			if (cmdp->cmdtype == CMDNORMAL)
+				printentry(cmdp, verbose);
 		}
 		return 0;
 	}
@@ -355,6 +412,13 @@ find_command(const_cstring_t name, struct cmdentry* entry, int32_t act,
 	int32_t i;
 	int32_t spec;
 	int32_t cd;
+	const_cstring_t start;
+	struct pathdir* pd;
+	size_t namelen;
+	time_t now;
+	int32_t recheck;
+	int32_t trusted;
+	int32_t has;
 	/* If name contains a slash, don't use the hash table */
 	if (strchr(name, '/') != NULL)
 	{
@@ -384,12 +448,27 @@ find_command(const_cstring_t name, struct cmdentry* entry, int32_t act,
 		INTON;
 		goto success;
 	}
-	/* We have to search path. */
+	/*
+	 * We have to search path.  Directories whose snapshot lacks the name
+	 * are skipped.  A snapshot that was taken on trust may be out of date,
+	 * so if that leaves the command unfound, search again checking them.
+	 */
+	namelen = strlen(name);
+	now = time(NULL);
+#ifdef PATHWATCH
+	pathwatchevents();
+#endif
+	start = path;
+	recheck = 0;
+search:
+	trusted = 0;
 	e = ENOENT;
 	idx = -1;
 	for (; (fullname = padvance(&path, name)) != NULL; stunalloc(fullname))
 	{
 		idx++;
+		pd = NULL;
+		has = PD_NOTFOUND;
 		if (pathopt)
 		{
 			if (strncmp(pathopt, "func", 4) == 0)
@@ -401,12 +480,26 @@ find_command(const_cstring_t name, struct cmdentry* entry, int32_t act,
 				continue; /* ignore unimplemented options */
 			}
 		}
+		else if (fullname[0] == '/')
+		{
+			pd = getpathdir(fullname, strlen(fullname) - namelen - 1,
+							now, recheck, &trusted);
+			if (pd != NULL && (has = pathdirhas(pd, name)) == PD_NOTFOUND)
+				continue;
+		}
 		if (fullname[0] != '/')
 			cd = 1;
-		if (stat(fullname, &statb) < 0)
+		if (has == PD_REGULAR)
+			statb.st_mode = S_IFREG;
+		else if (stat(fullname, &statb) < 0)
 		{
 			if (errno != ENOENT && errno != ENOTDIR)
 				e = errno;
+			else if (pd != NULL)
+			{
+				pd->state = PD_STALE;
+				trusted = 1;
+			}
 			continue;
 		}
 		e = EACCES;	/* if we fail, this will be the error */
@@ -448,6 +541,12 @@ find_command(const_cstring_t name, struct cmdentry* entry, int32_t act,
 		INTON;
 		goto success;
 	}
+	if (trusted && !recheck)
+	{
+		path = start;
+		recheck = 1;
+		goto search;
+	}
 	if (act & DO_ERR)
 	{
 		if (e == ENOENT || e == ENOTDIR)
@@ -469,22 +568,58 @@ success:
 
 
 /*
- * Search the table of builtin commands.
+ * Resolve the command name of the simple command n in PATH, like
+ * find_command(name, entry, 0, pathval()).  The name must be the literal
+ * first word of the command.  The table entry found is remembered in the
+ * node, which answers later lookups by itself until cmdgen changes.
  */
 
-int32_t
-find_builtin(const_cstring_t name, int32_t* special)
+void
+find_command_node(union node* n, const_cstring_t name, struct cmdentry* entry)
 {
-	const struct builtincmd* bp;
-	for (bp = builtincmd ; bp->name ; bp++)
+	ptblentry_t cmdp;
+	if (n->ncmd.cmdgen != cmdgen)
 	{
-		if (*bp->name == *name && equal(bp->name, name))
+		find_command(name, entry, 0, pathval());
+		if (entry->cmdtype != CMDUNKNOWN &&
+				(cmdp = cmdlookup(name, 0)) != NULL)
 		{
-			*special = bp->special;
-			return bp->code;
+			n->ncmd.cmdcache = cmdp;
+			n->ncmd.cmdgen = cmdgen;
 		}
+		return;
 	}
-	return -1;
+	cmdp = n->ncmd.cmdcache;
+	entry->cmdtype = cmdp->cmdtype;
+	entry->u = cmdp->param;
+	entry->special = cmdp->special;
+}
+
+
+
+/*
+ * Search the table of builtin commands.  The names are found with the
+ * perfect hash table built by mkbuiltins.
+ */
+
+int32_t
+find_builtin(const_cstring_t name, int32_t* special)
+{
+	const struct builtincmd* bp;
+	const_cstring_t p;
+	uint32_t h;
+	int32_t i;
+	h = 0;
+	for (p = name ; *p != '\0' ; p++)
+		h = (h + (unsigned char)*p) * BLTINHASHSEED;
+	h *= BLTINHASHSEED;
+	if ((i = builtinhash[h >> (32 - BLTINHASHBITS)]) < 0)
+		return -1;
+	bp = &builtincmd[i];
+	if (*bp->name != *name || !equal(bp->name, name))
+		return -1;
+	*special = bp->special;
+	return bp->code;
 }
 
 
@@ -506,93 +641,134 @@ hashcd(void)
 /*
  * Called before PATH is changed.  The argument is the new value of PATH;
  * pathval() still returns the old value at this point.  Called with
- * interrupts off.
+ * interrupts off.  Only the commands found in or after the first entry
+ * that differs need to be looked up again; the directory snapshots stay.
  */
 
 void
-changepath(const_cstring_t newval __unused)
+changepath(const_cstring_t newval)
 {
-	(void)newval;
-	clearcmdentry();
+	const_cstring_t old;
+	const_cstring_t new;
+	int32_t idx;
+	int32_t firstchange;
+	old = pathval();
+	new = newval;
+	firstchange = INT32_MAX;	/* assume no change */
+	idx = 0;
+	for (;;)
+	{
+		if (*old != *new)
+		{
+			firstchange = idx;
+			if ((*old == '\0' && *new == ':')
+					|| (*old == ':' && *new == '\0'))
+				firstchange++;
+			break;
+		}
+		if (*old == '\0')
+			break;
+		if (*old == ':')
+			idx++;
+		old++, new++;
+	}
+	clearcmdentries(firstchange);
 }
 
 
 /*
- * Clear out command entries.  The argument specifies the first entry in
- * PATH which has changed.
+ * Clear out command entries.
  */
 
 void
 clearcmdentry(void)
 {
-	ptblentry_t* tblp;
-	ptblentry_t* pp;
+	clearcmdentries(0);
+}
+
+
+/*
+ * Clear out the command entries found by a path search, starting with
+ * those found in the firstchange'th entry of PATH.
+ */
+
+static void
+clearcmdentries(int32_t firstchange)
+{
+	struct hashent* hp;
+	struct hashent* next;
 	ptblentry_t cmdp;
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++)
+	for (hp = hashnext(&cmdtable, NULL) ; hp ; hp = next)
 	{
-		pp = tblp;
-		while ((cmdp = *pp) != NULL)
+		next = hashnext(&cmdtable, hp);
+		cmdp = (ptblentry_t)hp;
+		if (cmdp->cmdtype == CMDNORMAL &&
+				(cmdp->param.index >= firstchange || firstchange == 0))
 		{
-			if (cmdp->cmdtype == CMDNORMAL)
-			{
-				*pp = cmdp->next;
-				ckfree(cmdp);
-			}
-			else
-			{
-				pp = &cmdp->next;
-			}
+			hashremove(&cmdtable, hp);
+			ckfree(cmdp);
 		}
 	}
-	cmdtable_cd = 0;
+	if (firstchange == 0)
+		cmdtable_cd = 0;
+	cmdchanged();
 	INTON;
 }
 
 
+/*
+ * Called when an entry of cmdtable is changed or deleted, to invalidate
+ * the entries remembered by find_command_node().
+ */
+
+static void
+cmdchanged(void)
+{
+	if (++cmdgen == 0)
+		cmdgen = 1;
+}
+
+
 /*
  * Locate a command in the command hash table.  If "add" is nonzero,
  * add the command to the table if it is not already present.  The
- * variable "lastcmdentry" is set to point to the address of the link
- * pointing to the entry, so that delete_cmd_entry can delete the
- * entry.
+ * variable "lastcmdentry" is set to the entry found, so that
+ * delete_cmd_entry can delete the entry.
  */
 
-static ptblentry_t* lastcmdentry;
+static ptblentry_t lastcmdentry;
 
 
 static ptblentry_t
 cmdlookup(const_cstring_t name, int32_t add)
 {
-	int32_t hashval;
-	const_cstring_t p;
+	struct hashent* hp;
 	ptblentry_t cmdp;
-	ptblentry_t* pp;
+	uint32_t hashval;
 	size_t len;
 
-	p = name;
-	hashval = *p << 4;
-	while (*p)
-		hashval += *p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
-	for (cmdp = *pp ; cmdp ; cmdp = cmdp->next)
+	hashval = hashstr(name);
+	cmdp = NULL;
+	for (hp = hashfirst(&cmdtable, hashval) ; hp ; hp = hp->next)
 	{
-		if (equal(cmdp->cmdname, name))
+		if (hp->hash == hashval && equal(((ptblentry_t)hp)->cmdname, name))
+		{
+			cmdp = (ptblentry_t)hp;
 			break;
-		pp = &cmdp->next;
+		}
 	}
 	if (add && cmdp == NULL)
 	{
 		INTOFF;
 		len = strlen(name);
-		cmdp = *pp = ckmalloc(sizeof(struct tblentry) + len + 1);
-		cmdp->next = NULL;
+		cmdp = ckmalloctag(sizeof(struct tblentry) + len + 1, MT_CMDHASH);
 		cmdp->cmdtype = CMDUNKNOWN;
 		memcpy(cmdp->cmdname, name, len + 1);
+		hashinsert(&cmdtable, &cmdp->hent, hashval);
 		INTON;
 	}
-	lastcmdentry = pp;
+	lastcmdentry = cmdp;
 
 	return cmdp;
 }
@@ -606,9 +782,10 @@ delete_cmd_entry(void)
 {
 	ptblentry_t cmdp;
 	INTOFF;
-	cmdp = *lastcmdentry;
-	*lastcmdentry = cmdp->next;
+	cmdp = lastcmdentry;
+	hashremove(&cmdtable, &cmdp->hent);
 	ckfree(cmdp);
+	cmdchanged();
 	INTON;
 }
 
@@ -631,10 +808,369 @@ addcmdentry(const_cstring_t name, struct cmdentry* entry)
 	}
 	cmdp->cmdtype = entry->cmdtype;
 	cmdp->param = entry->u;
+	cmdchanged();
+	INTON;
+}
+
+
+/*** Directory snapshots ***/
+
+
+/*
+ * Hash a name in a directory snapshot.
+ */
+
+static uint32_t
+pathdirhash(const_cstring_t name)
+{
+#ifdef PATHDIRFOLD
+	uint32_t h;
+	h = 2166136261U;
+	while (*name)
+		h = (h ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619U;
+	return h;
+#else
+	return hashstr(name);
+#endif
+}
+
+
+/*
+ * Tell whether a directory snapshot contains the name.
+ */
+
+static int32_t
+pathdirhas(struct pathdir* pd, const_cstring_t name)
+{
+	uint32_t i;
+	uint32_t off;
+	const_cstring_t p;
+	if (pd->state != PD_LIST)
+		return PD_NOTFOUND;
+	for (i = pathdirhash(name) & pd->tabmask ; (off = pd->tab[i]) != 0 ;
+			i = (i + 1) & pd->tabmask)
+	{
+		p = pd->names + (off & ~PD_REGBIT) - 1;
+#ifdef PATHDIRFOLD
+		if (strcasecmp(p, name) == 0)
+#else
+		if (equal(p, name))
+#endif
+			return off & PD_REGBIT ? PD_REGULAR : PD_FOUND;
+	}
+	return PD_NOTFOUND;
+}
+
+
+#ifdef PATHWATCH
+/*
+ * Return the inotify instance watching the PATH directories, or -1.
+ * Like ttyfd, it is kept out of the way of the user's redirections.
+ */
+
+static int32_t
+getpathwatchfd(void)
+{
+	int32_t fd;
+	if (pathwatchfd == -1)
+	{
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd >= 0 && fd < 10)
+		{
+			pathwatchfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+			close(fd);
+		}
+		else
+			pathwatchfd = fd;
+		if (pathwatchfd < 0)
+			pathwatchfd = -2;
+	}
+	return pathwatchfd < 0 ? -1 : pathwatchfd;
+}
+
+
+/*
+ * Mark the snapshots of the directories that changed since the last call
+ * stale.
+ */
+
+static void
+pathwatchevents(void)
+{
+	union
+	{
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct inotify_event* ev;
+	struct pathdir* pd;
+	cstring_t p;
+	ssize_t n;
+	if (pathwatchfd < 0)
+		return;
+	while ((n = read(pathwatchfd, u.buf, sizeof(u.buf))) > 0)
+	{
+		for (p = u.buf ; p < u.buf + n ; p += sizeof(*ev) + ev->len)
+		{
+			ev = (struct inotify_event*)(pvoid_t)p;
+			for (pd = pathdirs ; pd != NULL ; pd = pd->next)
+			{
+				if (pd->wd == ev->wd || ev->mask & IN_Q_OVERFLOW)
+				{
+					pd->state = PD_STALE;
+					if (ev->mask & IN_IGNORED)
+						pd->wd = -1;
+				}
+			}
+		}
+	}
+}
+#endif
+
+
+/*
+ * Stop watching a directory, unless another snapshot (of the same
+ * directory under another name) needs the watch.
+ */
+
+static void
+unwatchpathdir(struct pathdir* pd)
+{
+#ifdef PATHWATCH
+	struct pathdir* opd;
+	if (pd->wd < 0)
+		return;
+	for (opd = pathdirs ; opd != NULL ; opd = opd->next)
+		if (opd != pd && opd->wd == pd->wd)
+			break;
+	if (opd == NULL)
+		inotify_rm_watch(pathwatchfd, pd->wd);
+	pd->wd = -1;
+#else
+	(void)pd;
+#endif
+}
+
+
+/*
+ * Called in a forked child.  The child shares the inotify instance with
+ * its parent and must not take the parent's events, so from here on its
+ * snapshots are checked against the directories' modification times.
+ */
+
+void
+forgetpathwatch(void)
+{
+#ifdef PATHWATCH
+	struct pathdir* pd;
+	if (pathwatchfd >= 0)
+		close(pathwatchfd);
+	pathwatchfd = -1;
+	for (pd = pathdirs ; pd != NULL ; pd = pd->next)
+	{
+		pd->wd = -1;
+		pd->checked = 0;
+	}
+#endif
+}
+
+
+/*
+ * Read the directory described by statb into its snapshot.  Called with
+ * interrupts off.
+ */
+
+static void
+readpathdir(struct pathdir* pd, const struct stat* statb, time_t now)
+{
+	DIR* dirp;
+	struct dirent* dp;
+	size_t len;
+	size_t used;
+	size_t size;
+	uint32_t n;
+	uint32_t i;
+	uint32_t off;
+	uint32_t reg;
+	ckfree(pd->tab);
+	ckfree(pd->names);
+	pd->tab = NULL;
+	pd->names = NULL;
+	pd->dev = statb->st_dev;
+	pd->ino = statb->st_ino;
+	pd->mtime = statb->st_mtime;
+	pd->readtime = now;
+#ifdef PATHWATCH
+	/* Watch first, so that a change while reading is not missed. */
+	if (pd->wd < 0 && getpathwatchfd() >= 0)
+		pd->wd = inotify_add_watch(pathwatchfd, pd->dir,
+				IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+				IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+#endif
+	if ((dirp = opendir(pd->dir)) == NULL)
+	{
+		pd->state = PD_UNLISTED;
+		return;
+	}
+	used = size = 0;
+	n = 0;
+	while ((dp = readdir(dirp)) != NULL)
+	{
+		if (dp->d_name[0] == '.' && (dp->d_name[1] == '\0' ||
+				(dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+			continue;
+		len = strlen(dp->d_name) + 2;
+		if (used + len > size)
+		{
+			while (used + len > size)
+				size = size == 0 ? 1024 : size * 2;
+			if (pd->names == NULL)
+				pd->names = ckmalloctag(size, MT_CMDHASH);
+			else
+				pd->names = ckrealloc(pd->names, size);
+		}
+#ifdef DT_REG
+		pd->names[used] = dp->d_type == DT_REG;
+#else
+		pd->names[used] = 0;
+#endif
+		memcpy(pd->names + used + 1, dp->d_name, len - 1);
+		used += len;
+		n++;
+	}
+	closedir(dirp);
+	for (size = 8 ; size < 2 * (n + 1) ; size *= 2)
+		; /* nothing */
+	pd->tab = ckmalloctag(size * sizeof(*pd->tab), MT_CMDHASH);
+	memset(pd->tab, 0, size * sizeof(*pd->tab));
+	pd->tabmask = size - 1;
+	/* Each name is preceded by a byte telling if it is a regular file. */
+	for (off = 1 ; off < used ; off += strlen(pd->names + off) + 2)
+	{
+		reg = pd->names[off - 1] ? PD_REGBIT : 0;
+		for (i = pathdirhash(pd->names + off) & pd->tabmask ;
+				pd->tab[i] != 0 ; i = (i + 1) & pd->tabmask)
+			; /* nothing */
+		pd->tab[i] = (off + 1) | reg;
+	}
+	pd->state = PD_LIST;
+}
+
+
+static void
+freepathdir(struct pathdir* pd)
+{
+	unwatchpathdir(pd);
+	ckfree(pd->tab);
+	ckfree(pd->names);
+	ckfree(pd);
+}
+
+
+/*
+ * Find the snapshot of the directory named by the first dirlen characters
+ * of dir, bringing it up to date if need be.  A snapshot whose directory
+ * is watched is always current.  Otherwise, unless recheck is set, one
+ * that was found current within the last second is trusted without
+ * looking at the directory again, and *trusted is set.  Returns NULL if
+ * the directory cannot be listed; the caller has to stat() the file then.
+ */
+
+static struct pathdir*
+getpathdir(const_cstring_t dir, size_t dirlen, time_t now, int32_t recheck,
+		   int32_t* trusted)
+{
+	struct pathdir* pd;
+	struct pathdir** pdp;
+	struct stat statb;
+	for (pd = pathdirs ; pd != NULL ; pd = pd->next)
+		if (pd->dirlen == dirlen && memcmp(pd->dir, dir, dirlen) == 0)
+			break;
+	if (pd == NULL)
+	{
+		INTOFF;
+		if (npathdirs >= PATHDIRMAX)
+		{
+			pd = pathdirs;
+			pathdirs = pd->next;
+			npathdirs--;
+			freepathdir(pd);
+		}
+		pd = ckmalloctag(sizeof(*pd) + dirlen + 1, MT_CMDHASH);
+		memset(pd, 0, sizeof(*pd));
+		pd->dir = (cstring_t)(pd + 1);
+		memcpy(pd->dir, dir, dirlen);
+		pd->dir[dirlen] = '\0';
+		pd->dirlen = dirlen;
+		pd->state = PD_STALE;
+		pd->wd = -1;
+		for (pdp = &pathdirs ; *pdp != NULL ; pdp = &(*pdp)->next)
+			; /* nothing */
+		*pdp = pd;
+		npathdirs++;
+		INTON;
+	}
+	else if (pd->state != PD_STALE &&
+			 (pd->wd >= 0 || (pd->checked == now && !recheck)))
+	{
+		if (pd->wd < 0)
+			*trusted = 1;
+		return pd->state == PD_UNLISTED ? NULL : pd;
+	}
+	INTOFF;
+	if (stat(pd->dir, &statb) < 0)
+	{
+		if (errno != ENOENT && errno != ENOTDIR)
+		{
+			pd->state = PD_STALE;
+			INTON;
+			return NULL;
+		}
+		statb.st_mode = 0;
+	}
+	if (!S_ISDIR(statb.st_mode))
+	{
+		unwatchpathdir(pd);
+		ckfree(pd->tab);
+		ckfree(pd->names);
+		pd->tab = NULL;
+		pd->names = NULL;
+		pd->state = PD_ABSENT;
+	}
+	else if ((pd->state != PD_LIST && pd->state != PD_UNLISTED) ||
+			 statb.st_dev != pd->dev || statb.st_ino != pd->ino ||
+			 statb.st_mtime != pd->mtime || pd->mtime >= pd->readtime - 1)
+	{
+		if (statb.st_dev != pd->dev || statb.st_ino != pd->ino)
+			unwatchpathdir(pd);
+		readpathdir(pd, &statb, now);
+	}
 	INTON;
+	pd->checked = now;
+	return pd->state == PD_UNLISTED ? NULL : pd;
 }
 
 
+/*
+ * Forget all directory snapshots.
+ */
+
+static void
+clearpathdirs(void)
+{
+	struct pathdir* pd;
+	INTOFF;
+	while ((pd = pathdirs) != NULL)
+	{
+		pathdirs = pd->next;
+		freepathdir(pd);
+	}
+	npathdirs = 0;
+	INTON;
+}
+
+
+
 /*
  * Define a shell function.
  */
@@ -692,7 +1228,6 @@ typecmd_impl(int32_t argc, cstring_t* argv, int32_t cmd, const_cstring_t path)
 {
 	struct cmdentry entry;
 	ptblentry_t cmdp;
-	const_cstring_t const* pp;
 	struct alias* ap;
 	int32_t i;
 	int32_t error1 = 0;
@@ -701,10 +1236,7 @@ typecmd_impl(int32_t argc, cstring_t* argv, int32_t cmd, const_cstring_t path)
 	for (i = 1; i < argc; i++)
 	{
 		/* First look at the keywords */
-		for (pp = parsekwd; *pp; pp++)
-			if (**pp == *argv[i] && equal(*pp, argv[i]))
-				break;
-		if (*pp)
+		if (findkwd(argv[i]) >= 0)
 		{
 			if (cmd == TYPECMD_SMALLV)
 				out1fmt("%s\n", argv[i]);
@@ -69,10 +69,12 @@ struct cmdentry
 
 extern const_cstring_t pathopt;	/* set by padvance */
 extern int32_t exerrno;		/* last exec error */
+extern uint32_t cmdgen;		/* see find_command_node() */
 
 DECLSPEC_NORETURN void shellexec(cstring_t*, cstring_t*, const_cstring_t, int32_t);
 cstring_t padvance(const_cstring_t*, const_cstring_t);
 void find_command(const_cstring_t, struct cmdentry*, int32_t, const_cstring_t);
+void find_command_node(union node*, const_cstring_t, struct cmdentry*);
 int32_t find_builtin(const_cstring_t, int32_t*);
 void hashcd(void);
 void changepath(const_cstring_t);
@@ -81,3 +83,4 @@ int32_t unsetfunc(const_cstring_t);
 int32_t isfunc(const_cstring_t);
 int32_t typecmd_impl(int32_t, cstring_t*, int32_t, const_cstring_t);
 void clearcmdentry(void);
+void forgetpathwatch(void);
@@ -37,6 +37,8 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#undef CEOF			/* syntax.h redefines this */
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -97,6 +99,8 @@ static cstring_t argstr(cstring_t, int32_t);
 static cstring_t exptilde(cstring_t, int32_t);
 static cstring_t expari(cstring_t);
 static void expbackq(union node*, int32_t, int32_t);
+static cstring_t backqcopy(const_cstring_t, size_t, cstring_t, const_cstring_t,
+						   int32_t, size_t*);
 static int32_t subevalvar(cstring_t p, cstring_t str, size_t strloc, uint32_t subtype, size_t startloc, uint32_t varflags, uint32_t quotes);
 static cstring_t evalvar(cstring_t, int32_t);
 static int32_t varisset(const_cstring_t, int32_t);
@@ -161,6 +165,18 @@ expandarg(union node* arg, struct arglist* arglist, int32_t flag)
 {
 	struct strlist* sp;
 	cstring_t p;
+	size_t len;
+	if (arg->narg.literal && arglist != NULL)
+	{
+		/* Nothing to expand, split or match: copy the text. */
+		len = strlen(arg->narg.text) + 1;
+		sp = (struct strlist*)stalloc(sizeof(struct strlist) + len);
+		sp->text = memcpy(sp + 1, arg->narg.text, len);
+		sp->next = NULL;
+		*arglist->lastp = sp;
+		arglist->lastp = &sp->next;
+		return;
+	}
 	argbackq = arg->narg.backquote;
 	STARTSTACKSTR(expdest);
 	ifsfirst.next = NULL;
@@ -440,6 +456,62 @@ expari(cstring_t p)
 }
 
 
+/*
+ * Sizes of the buffer used to read the output of a command substitution.
+ * Each read asks for as much as is waiting in the pipe, within these bounds.
+ */
+
+#define BACKQMINREAD	4096
+#define BACKQMAXREAD	(1024 * 1024)
+
+/*
+ * Append len bytes of command substitution output to dest.  NUL bytes are
+ * dropped, characters that are special to the shell get a CTLESC if quotes
+ * is set, and newlines are held back in *nnl until something follows them
+ * so that trailing newlines are not copied.  Runs of other characters are
+ * copied in one go.
+ */
+
+static cstring_t
+backqcopy(const_cstring_t p, size_t len, cstring_t dest,
+		  const_cstring_t syntax, int32_t quotes, size_t* nnl)
+{
+	const_cstring_t end;
+	const_cstring_t q;
+	char c;
+	end = p + len;
+	while (p < end)
+	{
+		q = p;
+		while (q < end && *q != '\n' && *q != '\0' &&
+				(!quotes || syntax[(int32_t)*q] != CCTL))
+			q++;
+		if (q > p)
+		{
+			CHECKSTRSPACE(*nnl + (size_t)(q - p), dest);
+			for (; *nnl > 0 ; (*nnl)--)
+				USTPUTC('\n', dest);
+			memcpy(dest, p, q - p);
+			dest += q - p;
+			p = q;
+			continue;
+		}
+		c = *p++;
+		if (c == '\n')
+			(*nnl)++;
+		else if (c != '\0')
+		{
+			CHECKSTRSPACE(*nnl + 2, dest);
+			for (; *nnl > 0 ; (*nnl)--)
+				USTPUTC('\n', dest);
+			USTPUTC(CTLESC, dest);
+			USTPUTC(c, dest);
+		}
+	}
+	return dest;
+}
+
+
 /*
  * Perform command substitution.
  */
@@ -447,14 +519,18 @@ static void
 expbackq(union node* cmd, int32_t quoted, int32_t flag)
 {
 	struct backcmd in;
+	struct jmploc jmploc;
+	struct jmploc* const savehandler = handler;
 	ssize_t nreadbytes;
-	char buf[128] = {0};
+	cstring_t volatile rbuf;
+	int32_t rsize;
+	int32_t want;
+	int32_t avail;
 	cstring_t p;
 	cstring_t dest = expdest;
 	ifsregion_t saveifs;
 	pifsregion_t savelastp;
 	struct nodelist* saveargbackq;
-	char lastc;
 	size_t startloc = dest - stackblock();
 	char const* syntax = quoted ? DQSYNTAX : BASESYNTAX;
 	int32_t quotes = flag & (EXP_FULL | EXP_CASE | EXP_REDIR);
@@ -470,44 +546,40 @@ expbackq(union node* cmd, int32_t quoted, int32_t flag)
 	ifsfirst = saveifs;
 	ifslastp = savelastp;
 	argbackq = saveargbackq;
-	p = in.buf;
-	lastc = '\0';
 	nnl = 0;
 	/* Don't copy trailing newlines */
-	for (;;)
+	if (in.nleft > 0)
+		dest = backqcopy(in.buf, in.nleft, dest, syntax, quotes, &nnl);
+	rbuf = NULL;
+	rsize = 0;
+	if (setjmp(jmploc.loc))
 	{
-		if (--in.nleft < 0)
-		{
-			if (in.fd < 0)
-				break;
-			while ((nreadbytes = read(in.fd, buf, sizeof(buf))) < 0 && errno == EINTR);
-			TRACE(("expbackq: read returns %d\n", nreadbytes));
-			if (nreadbytes <= 0)
-				break;
-			p = buf;
-			in.nleft = nreadbytes - 1;
-		}
-		lastc = *p++;
-		if (lastc != '\0')
+		handler = savehandler;
+		ckfree(rbuf);
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
+	while (in.fd >= 0)
+	{
+		want = BACKQMINREAD;
+#ifdef FIONREAD
+		if (ioctl(in.fd, FIONREAD, &avail) == 0 && avail > want)
+			want = avail < BACKQMAXREAD ? avail : BACKQMAXREAD;
+#endif
+		if (want > rsize)
 		{
-			if (lastc == '\n')
-			{
-				nnl++;
-			}
-			else
-			{
-				CHECKSTRSPACE(nnl + 2, dest);
-				while (nnl > 0)
-				{
-					nnl--;
-					USTPUTC('\n', dest);
-				}
-				if (quotes && syntax[(int32_t)lastc] == CCTL)
-					USTPUTC(CTLESC, dest);
-				USTPUTC(lastc, dest);
-			}
+			rbuf = ckrealloc(rbuf, want);
+			rsize = want;
 		}
+		while ((nreadbytes = read(in.fd, rbuf, rsize)) < 0 && errno == EINTR);
+		TRACE(("expbackq: read returns %d\n", nreadbytes));
+		if (nreadbytes <= 0)
+			break;
+		dest = backqcopy(rbuf, nreadbytes, dest, syntax, quotes, &nnl);
 	}
+	handler = savehandler;
+	if (rbuf)
+		ckfree(rbuf);
 	if (in.fd >= 0)
 		close(in.fd);
 	if (in.buf)
@@ -940,7 +1012,7 @@ numvar:
 		case '-':
 			for (i = 0 ; i < NOPTS ; i++)
 			{
-				if (optlist[i].val)
+				if (optlist[i].val && optlist[i].letter != '\0')
 					STPUTC(optlist[i].letter, expdest);
 			}
 			break;
@@ -1691,6 +1763,65 @@ backtrack:
 
 
 
+/*
+ * Find the end of the next piece of a here-document that can be expanded
+ * on its own, so that no piece expands to much more than size bytes
+ * unless a single expansion does: a piece is either one ${...}, $(...)
+ * or $((...)) (or $name) or a run of at most about size bytes of text
+ * without expansions.  The command substitutions in the piece are counted
+ * in *nbackq so that the caller can advance the backquote list.
+ */
+
+const_cstring_t
+herepiece(const_cstring_t p, size_t size, int32_t* nbackq)
+{
+	const_cstring_t start;
+	int32_t depth;
+	int32_t single;
+	char c;
+	start = p;
+	depth = 0;
+	*nbackq = 0;
+	single = *p == CTLVAR || *p == CTLARI || *p == CTLBACKQ ||
+			 *p == (CTLBACKQ | CTLQUOTE);
+	while ((c = *p) != '\0')
+	{
+		if (depth == 0 && p > start &&
+				(single || c == CTLVAR || c == CTLARI || c == CTLBACKQ ||
+				 c == (CTLBACKQ | CTLQUOTE) || (size_t)(p - start) >= size))
+			break;
+		p++;
+		switch (c)
+		{
+			case CTLESC:
+				if (*p != '\0')
+					p++;
+				break;
+			case CTLVAR:
+				if ((*p & VSTYPE) != VSNORMAL)
+					depth++;
+				if (*p != '\0')
+					p++;		/* subtype */
+				while (*p != '\0' && *p++ != '=')
+					;		/* name */
+				break;
+			case CTLARI:
+				depth++;
+				break;
+			case CTLENDVAR:
+			case CTLENDARI:
+				depth--;
+				break;
+			case CTLBACKQ:
+			case CTLBACKQ | CTLQUOTE:
+				(*nbackq)++;
+				break;
+		}
+	}
+	return p;
+}
+
+
 /*
  * Remove any CTLESC and CTLQUOTEMARK characters from a string.
  */
@@ -60,5 +60,6 @@ struct arglist
 
 union node;
 void expandarg(union node*, struct arglist*, int32_t);
+const_cstring_t herepiece(const_cstring_t, size_t, int32_t*);
 void rmescapes(cstring_t);
 int32_t casematch(union node*, const_cstring_t);
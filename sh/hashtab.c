@@ -0,0 +1,179 @@
+/*-
+ * Copyright (c) 2026 The freebsdsh contributors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Hash tables keyed by name.
+ *
+ * The tables of variables, aliases and commands are chained hash tables
+ * whose entries embed a struct hashent.  The hash of the name is stored
+ * in the entry, so a lookup compares names only when the full hashes
+ * match, and the table is doubled without hashing any name again when
+ * it holds as many entries as it has chains.  Entries stay where they
+ * were allocated, since the static variables and the commands cached in
+ * parse trees are referred to by address.
+ */
+
+#include "shell.h"
+#include "memalloc.h"
+#include "sherror.h"
+#include "hashtab.h"
+
+#define HASHTABMIN 32		/* initial number of chains, a power of 2 */
+
+static void growhashtab(struct hashtab*);
+
+
+/*
+ * Hash len bytes starting at p (FNV-1a).
+ */
+
+uint32_t
+hashmem(const_pvoid_t p, size_t len)
+{
+	const unsigned char* q = p;
+	uint32_t h;
+	h = 2166136261U;
+	while (len-- > 0)
+		h = (h ^ *q++) * 16777619U;
+	return h;
+}
+
+
+/*
+ * Hash a string.  Gives the same result as hashmem() on its characters.
+ */
+
+uint32_t
+hashstr(const_cstring_t s)
+{
+	uint32_t h;
+	h = 2166136261U;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+
+/*
+ * Double the number of chains in a table.
+ */
+
+static void
+growhashtab(struct hashtab* t)
+{
+	struct hashent** chains;
+	struct hashent* hp;
+	struct hashent* next;
+	uint32_t size;
+	uint32_t i;
+	INTOFF;
+	size = t->chains == NULL ? HASHTABMIN : (t->mask + 1) * 2;
+	chains = ckmalloctag(size * sizeof(*chains), t->tag);
+	memset(chains, 0, size * sizeof(*chains));
+	if (t->chains != NULL)
+	{
+		for (i = 0 ; i <= t->mask ; i++)
+		{
+			for (hp = t->chains[i] ; hp != NULL ; hp = next)
+			{
+				next = hp->next;
+				hp->next = chains[hp->hash & (size - 1)];
+				chains[hp->hash & (size - 1)] = hp;
+			}
+		}
+		ckfree(t->chains);
+	}
+	t->chains = chains;
+	t->mask = size - 1;
+	INTON;
+}
+
+
+/*
+ * Add an entry whose name has the given hash.  The caller must have
+ * checked that the name is not in the table yet.
+ */
+
+void
+hashinsert(struct hashtab* t, struct hashent* hp, uint32_t hash)
+{
+	struct hashent** pp;
+	if (t->chains == NULL || t->count > t->mask)
+		growhashtab(t);
+	pp = &t->chains[hash & t->mask];
+	hp->hash = hash;
+	hp->next = *pp;
+	*pp = hp;
+	t->count++;
+}
+
+
+/*
+ * Unlink an entry from a table.  The entry itself is not freed.
+ */
+
+void
+hashremove(struct hashtab* t, struct hashent* hp)
+{
+	struct hashent** pp;
+	for (pp = &t->chains[hp->hash & t->mask] ; *pp != hp ; pp = &(*pp)->next)
+		;
+	*pp = hp->next;
+	t->count--;
+}
+
+
+/*
+ * Return the entry following hp in a table, or the first entry if hp is
+ * NULL.  Entries are returned in no particular order.  The entry returned
+ * stays valid if hp is removed afterwards.
+ */
+
+struct hashent*
+hashnext(const struct hashtab* t, const struct hashent* hp)
+{
+	uint32_t i;
+	if (hp != NULL)
+	{
+		if (hp->next != NULL)
+			return hp->next;
+		i = (hp->hash & t->mask) + 1;
+	}
+	else
+	{
+		if (t->chains == NULL)
+			return NULL;
+		i = 0;
+	}
+	for (; i <= t->mask ; i++)
+		if (t->chains[i] != NULL)
+			return t->chains[i];
+	return NULL;
+}
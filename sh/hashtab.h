@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2026 The freebsdsh contributors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HASHTAB_H_
+#define HASHTAB_H_
+
+/*
+ * Hash tables keyed by name, shared by variables, aliases and the
+ * command table.  An entry embeds a struct hashent as its first member
+ * and is linked into the table in place, so it never moves.
+ */
+
+struct hashent
+{
+	struct hashent* next;		/* next entry in the chain */
+	uint32_t hash;				/* hash of the name of the entry */
+};
+
+struct hashtab
+{
+	struct hashent** chains;	/* mask + 1 chains, or NULL if empty */
+	uint32_t mask;				/* number of chains minus one */
+	uint32_t count;				/* number of entries */
+	int32_t tag;				/* memory tag for chains */
+};
+
+#define HASHTAB_INIT(tag)	{ NULL, 0, 0, (tag) }
+
+/* first entry of the chain for hash h */
+#define hashfirst(t, h)	((t)->chains != NULL ? (t)->chains[(h) & (t)->mask] : NULL)
+
+uint32_t hashmem(const_pvoid_t, size_t);
+uint32_t hashstr(const_cstring_t);
+void hashinsert(struct hashtab*, struct hashent*, uint32_t);
+void hashremove(struct hashtab*, struct hashent*);
+struct hashent* hashnext(const struct hashtab*, const struct hashent*);
+
+#endif
@@ -502,6 +502,29 @@ str_to_event(const_cstring_t str, int32_t last)
 	return (he.num);
 }
 
+/*
+ * Count the history entries and the bytes of text they hold.  The
+ * history is allocated by libedit, so it is not covered by the ckmalloc()
+ * accounting and has to be measured by walking it.
+ */
+void
+histmemstats(size_t* nentries, size_t* nbytes)
+{
+	HistEvent he;
+	int32_t retval;
+	*nentries = *nbytes = 0;
+	if (hist == NULL)
+		return;
+	INTOFF;
+	for (retval = history(hist, &he, H_FIRST) ; retval != -1 ;
+			retval = history(hist, &he, H_NEXT))
+	{
+		(*nentries)++;
+		*nbytes += strlen(he.str) + 1;
+	}
+	INTON;
+}
+
 int32_t
 bindcmd(int32_t argc, cstring_t* argv)
 {
@@ -0,0 +1,443 @@
+/*-
+ * Copyright (c) 2026 The freebsdsh contributors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Precompiled script images.
+ *
+ * The "precompile" builtin parses a script without executing it and
+ * writes the parsed commands to "script.shc".  Each command is stored as
+ * the block built by copyfunc() together with the address the block had
+ * when it was written; loadimage() reads the blocks back and relocates
+ * them with relocfunc(), which is much cheaper than lexing and parsing
+ * the script again.  The "." command and the profiles read at login use
+ * an image in place of the script as long as it matches the size,
+ * modification time and contents of the script.
+ *
+ * The parser substitutes aliases, so an image represents the script only
+ * if no aliases are defined, both when it is written and when it is used.
+ * Each command is stored with the input position after it, so that the
+ * rest of the script can be parsed from the source if a command changes
+ * an alias (see dotreplay() in main.c).  An
+ * image is only used if it is owned by the user or by root and cannot be
+ * written by anybody else, since it is not checked as thoroughly as the
+ * script would be by the parser.
+ */
+
+#include "shell.h"
+#include "nodes.h"
+#include "parser.h"
+#include "input.h"
+#include "image.h"
+#include "alias.h"
+#include "options.h"
+#include "output.h"
+#include "memalloc.h"
+#include "sherror.h"
+#include "mystring.h"
+#include "builtins.h"
+
+
+#define IMGMAGIC	0x53484331	/* "SHC1", byte-swapped on the wrong machine */
+#define IMGVERSION	3
+#define IMGLAYOUT	((uint32_t)(sizeof(union node) | \
+				sizeof(struct nodelist) << 8 | \
+				sizeof(pvoid_t) << 16))
+#define IMGSUFFIX	".shc"
+#define IMGMAXSIZE	(64 * 1024 * 1024)
+#define IMGALIGN(n)	(((n) + 7) & ~(size_t)7)
+
+struct imghdr
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t layout;	/* sizes of nodes and pointers */
+	uint32_t ncmds;		/* number of commands */
+	uint32_t srchash;	/* hash of the contents of the script */
+	uint32_t pad;
+	int64_t srcsize;	/* size of the script */
+	int64_t srcmtime;	/* modification time of the script */
+};
+
+struct imgcmd
+{
+	uint64_t size;		/* size of the block that follows */
+	uint64_t addr;		/* address of the block when written */
+	int64_t offset;		/* input position after the command */
+	int32_t linno;
+	int32_t pad;
+};
+
+
+static cstring_t imgname(const_cstring_t);
+static int32_t imghash(const_cstring_t, off_t, uint32_t*);
+static void precompile(const_cstring_t, int32_t);
+static uint32_t usecs(void);
+
+static struct funcdef** pc_cmds;	/* commands being precompiled */
+static struct inputpos* pc_ends;	/* input positions after them */
+static int32_t pc_ncmds;
+
+
+static cstring_t
+imgname(const_cstring_t source)
+{
+	cstring_t name;
+	name = stalloc(strlen(source) + sizeof(IMGSUFFIX));
+	strcpy(name, source);
+	strcat(name, IMGSUFFIX);
+	return name;
+}
+
+
+/*
+ * Compute the FNV-1a hash of a file, which must have the given size.
+ */
+
+static int32_t
+imghash(const_cstring_t name, off_t size, uint32_t* hashp)
+{
+	char buf[8192];
+	uint32_t hash;
+	ssize_t nr;
+	ssize_t i;
+	int32_t fd;
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	hash = 2166136261U;
+	while ((nr = read(fd, buf, sizeof(buf))) > 0)
+	{
+		for (i = 0 ; i < nr ; i++)
+			hash = (hash ^ (unsigned char)buf[i]) * 16777619U;
+		size -= nr;
+	}
+	close(fd);
+	if (nr < 0 || size != 0)
+		return -1;
+	*hashp = hash;
+	return 0;
+}
+
+
+/*
+ * Load the image of a script.  Returns an array of *ncmds function
+ * definitions and sets *ends to the input positions after them, or
+ * returns NULL if there is no usable image.
+ */
+
+struct funcdef**
+loadimage(const_cstring_t source, const struct stat* srcst, int32_t* ncmds,
+		  struct inputpos** ends)
+{
+	struct stat statb;
+	struct imghdr hdr;
+	struct imgcmd cmd;
+	struct funcdef** cmds;
+	struct inputpos* pos;
+	cstring_t buf;
+	cstring_t p;
+	pvoid_t block;
+	size_t left;
+	uint32_t hash;
+	int32_t fd;
+	int32_t i;
+	if (vflag || aliases != 0)
+		return NULL;
+	if ((fd = open(imgname(source), O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	buf = NULL;
+	cmds = NULL;
+	pos = NULL;
+	i = 0;
+	INTOFF;
+	if (fstat(fd, &statb) != 0 || !S_ISREG(statb.st_mode) ||
+			(statb.st_uid != geteuid() && statb.st_uid != 0) ||
+			(statb.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+			statb.st_size < (off_t)sizeof(hdr) ||
+			statb.st_size > IMGMAXSIZE)
+		goto bad;
+	left = statb.st_size;
+	buf = ckmalloc(left);
+	if (read(fd, buf, left) != (ssize_t)left)
+		goto bad;
+	close(fd);
+	fd = -1;
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != IMGMAGIC || hdr.version != IMGVERSION ||
+			hdr.layout != IMGLAYOUT || hdr.srcsize != srcst->st_size ||
+			hdr.srcmtime != srcst->st_mtime ||
+			hdr.ncmds > left / sizeof(cmd) ||
+			imghash(source, srcst->st_size, &hash) != 0 ||
+			hash != hdr.srchash)
+		goto bad;
+	p = buf + sizeof(hdr);
+	left -= sizeof(hdr);
+	cmds = ckmalloctag((hdr.ncmds + 1) * sizeof(*cmds), MT_DOTCACHE);
+	pos = ckmalloctag((hdr.ncmds + 1) * sizeof(*pos), MT_DOTCACHE);
+	for (i = 0 ; i < (int32_t)hdr.ncmds ; i++)
+	{
+		if (left < sizeof(cmd))
+			goto bad;
+		memcpy(&cmd, p, sizeof(cmd));
+		p += sizeof(cmd);
+		left -= sizeof(cmd);
+		if (cmd.size > left || cmd.offset < 0 ||
+				cmd.offset > srcst->st_size)
+			goto bad;
+		pos[i].offset = cmd.offset;
+		pos[i].linno = cmd.linno;
+		block = ckmalloctag(cmd.size, MT_DOTCACHE);
+		memcpy(block, p, cmd.size);
+		if ((cmds[i] = relocfunc(block, cmd.size,
+						(const void*)(uintptr_t)cmd.addr)) == NULL)
+		{
+			ckfree(block);
+			goto bad;
+		}
+		if (IMGALIGN(cmd.size) > left)
+			left = 0;
+		else
+			left -= IMGALIGN(cmd.size);
+		p += IMGALIGN(cmd.size);
+	}
+	ckfree(buf);
+	INTON;
+	*ncmds = hdr.ncmds;
+	*ends = pos;
+	return cmds;
+bad:
+	if (fd >= 0)
+		close(fd);
+	while (--i >= 0)
+		unreffunc(cmds[i]);
+	ckfree(cmds);
+	ckfree(pos);
+	ckfree(buf);
+	INTON;
+	return NULL;
+}
+
+
+static uint32_t
+usecs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint32_t)tv.tv_sec * 1000000U + (uint32_t)tv.tv_usec;
+}
+
+
+/*
+ * Parse a script and write its image.
+ */
+
+static void
+precompile(const_cstring_t source, int32_t verbose)
+{
+	struct jmploc jmploc;
+	struct jmploc* volatile savehandler;
+	struct stackmark smark;
+	struct stat statb;
+	struct stat statb2;
+	struct imghdr hdr;
+	struct imgcmd cmd;
+	struct funcdef** cmds;
+	struct inputpos* ends;
+	union node* n;
+	cstring_t volatile tmpname;
+	cstring_t name;
+	static const char zero[8];
+	uint32_t parsetime;
+	uint32_t loadtime;
+	int32_t volatile fd;
+	int32_t volatile pushed;
+	int32_t maxcmds;
+	int32_t i;
+	if (stat(source, &statb) != 0)
+		sherror("%s: %s", source, strerror(errno));
+	if (!S_ISREG(statb.st_mode))
+		sherror("%s: not a regular file", source);
+	name = imgname(source);
+	tmpname = NULL;
+	fd = -1;
+	pushed = 0;
+	pc_cmds = NULL;
+	pc_ends = NULL;
+	pc_ncmds = maxcmds = 0;
+	savehandler = handler;
+	if (setjmp(jmploc.loc))
+	{
+		handler = savehandler;
+		if (pushed)
+			popfile();
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(tmpname);
+		}
+		while (pc_ncmds > 0)
+			unreffunc(pc_cmds[--pc_ncmds]);
+		ckfree(pc_cmds);
+		ckfree(pc_ends);
+		pc_cmds = NULL;
+		pc_ends = NULL;
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
+	parsetime = usecs();
+	setinputfile(source, 1);
+	pushed = 1;
+	setstackmark(&smark);
+	while ((n = parsecmd(0)) != NEOF)
+	{
+		if (n != NULL)
+		{
+			if (pc_ncmds == maxcmds)
+			{
+				maxcmds = maxcmds ? maxcmds * 2 : 16;
+				INTOFF;
+				pc_cmds = ckrealloc(pc_cmds, maxcmds * sizeof(*pc_cmds));
+				pc_ends = ckrealloc(pc_ends, maxcmds * sizeof(*pc_ends));
+				INTON;
+			}
+			if (getinputpos(&pc_ends[pc_ncmds]) != 0)
+				sherror("%s: contains nul characters", source);
+			INTOFF;
+			pc_cmds[pc_ncmds++] = copyfunc(n);
+			INTON;
+		}
+		popstackmark(&smark);
+		setstackmark(&smark);
+	}
+	popstackmark(&smark);
+	popfile();
+	pushed = 0;
+	parsetime = usecs() - parsetime;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = IMGMAGIC;
+	hdr.version = IMGVERSION;
+	hdr.layout = IMGLAYOUT;
+	hdr.ncmds = pc_ncmds;
+	hdr.srcsize = statb.st_size;
+	hdr.srcmtime = statb.st_mtime;
+	if (imghash(source, statb.st_size, &hdr.srchash) != 0 ||
+			stat(source, &statb2) != 0 ||
+			statb2.st_mtime != statb.st_mtime)
+		sherror("%s: changed while being read", source);
+	tmpname = stalloc(strlen(name) + 8);
+	strcpy(tmpname, name);
+	strcat(tmpname, ".XXXXXX");
+	INTOFF;
+	fd = mkstemp(tmpname);
+	INTON;
+	if (fd < 0)
+		sherror("%s: %s", tmpname, strerror(errno));
+	if (xwrite(fd, (const_cstring_t)&hdr, sizeof(hdr)) != sizeof(hdr))
+		goto error;
+	for (i = 0 ; i < pc_ncmds ; i++)
+	{
+		cmd.size = funcsize(pc_cmds[i]);
+		cmd.addr = (uintptr_t)pc_cmds[i];
+		cmd.offset = pc_ends[i].offset;
+		cmd.linno = pc_ends[i].linno;
+		cmd.pad = 0;
+		if (xwrite(fd, (const_cstring_t)&cmd, sizeof(cmd)) != sizeof(cmd) ||
+				xwrite(fd, (const_cstring_t)pc_cmds[i], cmd.size) !=
+				(int32_t)cmd.size ||
+				xwrite(fd, zero, IMGALIGN(cmd.size) - cmd.size) !=
+				(int32_t)(IMGALIGN(cmd.size) - cmd.size))
+			goto error;
+	}
+	if (fchmod(fd, statb.st_mode & 0644) != 0 || close(fd) != 0)
+	{
+		fd = -1;
+		unlink(tmpname);
+		sherror("%s: %s", tmpname, strerror(errno));
+	}
+	fd = -1;
+	if (rename(tmpname, name) != 0)
+	{
+		unlink(tmpname);
+		sherror("%s: %s", name, strerror(errno));
+	}
+	if (verbose)
+	{
+		loadtime = usecs();
+		cmds = loadimage(source, &statb, &i, &ends);
+		loadtime = usecs() - loadtime;
+		if (cmds == NULL)
+			sherror("%s: image cannot be loaded", name);
+		out1fmt("%s: %d commands, parsed in %lu us, loaded in %lu us\n",
+				source, (int)pc_ncmds, (unsigned long)parsetime,
+				(unsigned long)loadtime);
+		INTOFF;
+		while (--i >= 0)
+			unreffunc(cmds[i]);
+		ckfree(cmds);
+		ckfree(ends);
+		INTON;
+	}
+	handler = savehandler;
+	INTOFF;
+	while (pc_ncmds > 0)
+		unreffunc(pc_cmds[--pc_ncmds]);
+	ckfree(pc_cmds);
+	ckfree(pc_ends);
+	pc_cmds = NULL;
+	pc_ends = NULL;
+	INTON;
+	return;
+error:
+	sherror("%s: %s", tmpname, strerror(errno));
+}
+
+
+int32_t
+precompilecmd(int32_t argc __unused, cstring_t* argv __unused)
+{
+	int32_t verbose;
+	(void)argc; (void)argv;
+
+	verbose = 0;
+	while (nextopt("v") != '\0')
+		verbose = 1;
+	if (*argptr == NULL)
+		sherror("usage: precompile [-v] file ...");
+	if (aliases != 0)
+		sherror("cannot precompile while aliases are defined");
+	for (; *argptr != NULL ; argptr++)
+		precompile(*argptr, verbose);
+	return 0;
+}
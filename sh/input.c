@@ -33,6 +33,7 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>	/* defines BUFSIZ */
 #include <fcntl.h>
 #include <errno.h>
@@ -57,7 +58,16 @@
 #include "myhistedit.h"
 #include "trap.h"
 
-#define EOF_NLEFT SIZE_MAX		/* -99 value of parsenleft when EOF pushed back */
+#define EOF_NLEFT SIZE_MAX		/* parsenleft after PEOF was returned */
+#define EOF_UNGOT (SIZE_MAX - 1)	/* parsenleft when PEOF was pushed back */
+
+/*
+ * Scripts in regular files are not read BUFSIZ bytes at a time: they get
+ * a read buffer sized to the file, up to INPUTBUFMAX bytes.  They are not
+ * mapped, since a script that is truncated while it runs would then kill
+ * the shell with SIGBUS instead of ending or showing the new contents.
+ */
+#define INPUTBUFMAX	65536			/* largest read buffer */
 
 struct strpush
 {
@@ -82,6 +92,8 @@ struct parsefile
 	size_t lleft;		/* number of lines left in this buffer */
 	const_cstring_t nextc;	/* next char in buffer */
 	cstring_t buf;		/* input buffer */
+	size_t bufsize;		/* size of buf (less room for a nul) */
+	int32_t nuldeleted;	/* nul characters were deleted from buf */
 	struct strpush* strpush; /* for pushing strings at this level */
 	struct strpush basestrpush; /* so pushing one is fast */
 };
@@ -95,7 +107,8 @@ static char basebuf[BUFSIZ + 1];/* buffer for top level input file */
 static struct parsefile basepf =  	/* top level input file */
 {
 	.nextc = basebuf,
-	.buf = basebuf
+	.buf = basebuf,
+	.bufsize = BUFSIZ
 };
 static struct parsefile* parsefile = &basepf;	/* current input file */
 int32_t whichprompt;		/* 1 == PS1, 2 == PS2 */
@@ -103,6 +116,7 @@ int32_t whichprompt;		/* 1 == PS1, 2 == PS2 */
 EditLine* el;			/* cookie for editline package */
 
 static void pushfile(void);
+static void freeinputbuf(struct parsefile*);
 static ssize_t preadfd(void);
 static void popstring(void);
 
@@ -124,7 +138,7 @@ int32_t
 pgetc(void)
 {
 	// #define pgetc_macro()	(--parsenleft >= 0? *parsenextc++ : preadbuffer())
-	if (parsenleft > 0)
+	if (parsenleft > 0 && parsenleft < EOF_UNGOT)
 	{
 		--parsenleft;
 		return *parsenextc++;
@@ -153,8 +167,8 @@ retry:
 		else
 		{
 			nr = el_len;
-			if (nr > BUFSIZ)
-				nr = BUFSIZ;
+			if (nr > (ssize_t)parsefile->bufsize)
+				nr = parsefile->bufsize;
 			memcpy(parsefile->buf, rl_cp, nr);
 			if (nr != el_len)
 			{
@@ -166,7 +180,7 @@ retry:
 		}
 	}
 	else
-		nr = read(parsefile->fd, parsefile->buf, BUFSIZ);
+		nr = read(parsefile->fd, parsefile->buf, parsefile->bufsize);
 	if (nr <= 0)
 	{
 		if (nr < 0)
@@ -196,17 +210,23 @@ retry:
  * Refill the input buffer and return the next input character:
  *
  * 1) If a string was pushed back on the input, pop it;
- * 2) If an EOF was pushed back (parsenleft == EOF_NLEFT) or we are reading
+ * 2) If an EOF was pushed back (parsenleft == EOF_UNGOT) or we are reading
  *    from a string so we can't refill the buffer, return EOF.
  * 3) If there is more in this buffer, use it else call read to fill it.
  * 4) Process input up to the next newline, deleting nul characters.
+ *
+ * The newline and the nul characters are searched for with memchr() over
+ * the whole buffer rather than a byte at a time; nul characters are rare
+ * and are deleted from the rest of the buffer in one pass when one is
+ * found in the current line.
  */
 int32_t
 preadbuffer(void)
 {
 	cstring_t p;
 	cstring_t q;
-	int32_t more;
+	cstring_t r;
+	cstring_t end;
 	char savec;
 
 /* !!!! NOTE: This code needs to be reimplemented !!!! */
@@ -220,14 +240,17 @@ preadbuffer(void)
 		if (parsenleft == 0 /*-1*/ && parsefile->strpush->ap != NULL)
 			return ' ';
 		popstring();
-		if (parsenleft > 0)
+		if (parsenleft > 0 && parsenleft < EOF_UNGOT)
 		{
 			--parsenleft;
 			return (*parsenextc++);
 		}
 	}
-	if (parsenleft == EOF_NLEFT || parsefile->buf == NULL)
+	if (parsenleft == EOF_UNGOT || parsefile->buf == NULL)
+	{
+		parsenleft = EOF_NLEFT;
 		return PEOF;
+	}
 	flushout(&output);
 	flushout(&errout);
 again:
@@ -235,56 +258,62 @@ again:
 	{
 		if ((parselleft = preadfd()) == -1)
 		{
-			parselleft = parsenleft = EOF_NLEFT;
+			/* the next call reads again, as after a terminal EOF */
+			parselleft = 0;
+			parsenleft = EOF_NLEFT;
 			return PEOF;
 		}
 	}
-	q = p = parsefile->buf + (parsenextc - parsefile->buf);
-	/* delete nul characters */
-	for (more = 1; more;)
+	p = parsefile->buf + (parsenextc - parsefile->buf);
+	end = p + parselleft;
+	q = memchr(p, '\n', parselleft);
+	if (memchr(p, '\0', (q != NULL ? q + 1 : end) - p) != NULL)
 	{
-		switch (*p)
-		{
-			case '\0':
-				p++;	/* Skip nul */
-				goto check;
-			case '\n':
-				parsenleft = (q - parsenextc);
-				more = 0; /* Stop processing here */
-				break;
-			default:
-				break;
-		}
-		*q++ = *p++;
-check:
-		if (--parselleft <= 0)
-		{
-			parsenleft = (q - parsenextc - 1);
-			if (parsenleft < 0)
-				goto again;
-			*q = '\0';
-			more = 0;
-		}
+		/* delete nul characters */
+		parsefile->nuldeleted = 1;
+		for (r = q = p ; q != end ; q++)
+			if (*q != '\0')
+				*r++ = *q;
+		parselleft = r - p;
+		if (parselleft == 0)
+			goto again;
+		end = r;
+		q = memchr(p, '\n', parselleft);
 	}
-	savec = *q;
-	*q = '\0';
+	if (q == NULL)
+	{
+		q = end;
+		parsenleft = parselleft;
+		parselleft = 0;
+	}
+	else
+	{
+		q++;	/* include newline */
+		parsenleft = q - p;
+		parselleft -= parsenleft;
+	}
+	parsenleft--;
 
-	if (parsefile->fd == 0 && hist &&
-			parsenextc[strspn(parsenextc, " \t\n")] != '\0')
+	if (parsefile->fd == 0 && hist)
 	{
-		HistEvent he;
-		INTOFF;
-		history(hist, &he, whichprompt == 1 ? H_ENTER : H_ADD,
-				parsenextc);
-		INTON;
+		savec = *q;
+		*q = '\0';
+		if (parsenextc[strspn(parsenextc, " \t\n")] != '\0')
+		{
+			HistEvent he;
+			INTOFF;
+			history(hist, &he, whichprompt == 1 ? H_ENTER : H_ADD,
+					parsenextc);
+			INTON;
+		}
+		*q = savec;
 	}
 
 	if (vflag)
 	{
-		out2str(parsenextc);
+		outbin(parsenextc, q - parsenextc, out2);
 		flushout(out2);
 	}
-	*q = savec;
 	return *parsenextc++;
 }
 
@@ -296,11 +325,11 @@ check:
 int32_t
 preadateof(void)
 {
-	if (parsenleft > 0)
+	if (parsenleft > 0 && parsenleft < EOF_UNGOT)
 		return 0;
 	if (parsefile->strpush)
 		return 0;
-	if (parsenleft == EOF_NLEFT || parsefile->buf == NULL)
+	if (parsenleft >= EOF_UNGOT || parsefile->buf == NULL)
 		return 1;
 	return 0;
 }
@@ -313,6 +342,11 @@ preadateof(void)
 void
 pungetc(void)
 {
+	if (parsenleft == EOF_NLEFT)
+	{
+		parsenleft = EOF_UNGOT;
+		return;
+	}
 	parsenleft++;
 	parsenextc--;
 }
@@ -402,18 +436,70 @@ setinputfile(const_cstring_t fname, int32_t push)
 void
 setinputfd(int32_t fd, int32_t push)
 {
+	struct stat st;
+	size_t bufsize;
 	if (push)
 	{
 		pushfile();
-		parsefile->buf = ckmalloc(BUFSIZ + 1);
+		parsefile->buf = NULL;
 	}
 	if (parsefile->fd > 0)
 		close(parsefile->fd);
 	parsefile->fd = fd;
-	if (parsefile->buf == NULL)
-		parsefile->buf = ckmalloc(BUFSIZ + 1);
+	parsefile->nuldeleted = 0;
 	parselleft = parsenleft = 0;
 	plinno = 1;
+	bufsize = BUFSIZ;
+	if (fd != 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		if (st.st_size > BUFSIZ)
+			bufsize = st.st_size < INPUTBUFMAX ? st.st_size : INPUTBUFMAX;
+	}
+	if (parsefile->buf == NULL || parsefile->bufsize != bufsize)
+	{
+		freeinputbuf(parsefile);
+		parsefile->buf = ckmalloc(bufsize + 1);
+		parsefile->bufsize = bufsize;
+	}
+}
+
+
+/*
+ * Get the position in the input file of the next character to be read,
+ * so that parsing can later be resumed there with setinputpos().  Fails
+ * if the input is not a file that can be repositioned, if a string is
+ * pushed on it or if nul characters were deleted from it.
+ */
+
+int32_t
+getinputpos(struct inputpos* pos)
+{
+	off_t offset;
+	if (parsefile->fd < 0 || parsefile->strpush != NULL ||
+			parsefile->nuldeleted)
+		return -1;
+	if ((offset = lseek(parsefile->fd, 0, SEEK_CUR)) < 0)
+		return -1;
+	if (parsenleft < EOF_UNGOT)
+		offset -= parsenleft;
+	pos->offset = offset - parselleft;
+	pos->linno = plinno;
+	return 0;
+}
+
+
+/*
+ * Continue reading the input file at a position got from getinputpos().
+ */
+
+void
+setinputpos(const struct inputpos* pos)
+{
+	if (lseek(parsefile->fd, (off_t)pos->offset, SEEK_SET) < 0)
+		sherror("cannot seek: %s", strerror(errno));
+	parsenextc = parsefile->buf;
+	parselleft = parsenleft = 0;
+	plinno = pos->linno;
 }
 
 
@@ -429,7 +515,7 @@ setinputstring(const_cstring_t string, int32_t push)
 		pushfile();
 	parsenextc = string;
 	parselleft = parsenleft = strlen(string);
-	parsefile->buf = NULL;
+	freeinputbuf(parsefile);
 	plinno = 1;
 	INTON;
 }
@@ -452,6 +538,8 @@ pushfile(void)
 	pf = (struct parsefile*)ckmalloc(sizeof(struct parsefile));
 	pf->prev = parsefile;
 	pf->fd = -1;
+	pf->buf = NULL;
+	pf->nuldeleted = 0;
 	pf->strpush = NULL;
 	pf->basestrpush.prev = NULL;
 	parsefile = pf;
@@ -465,8 +553,7 @@ popfile(void)
 	INTOFF;
 	if (pf->fd >= 0)
 		close(pf->fd);
-	if (pf->buf)
-		ckfree(pf->buf);
+	freeinputbuf(pf);
 	while (pf->strpush)
 		popstring();
 	parsefile = pf->prev;
@@ -479,6 +566,15 @@ popfile(void)
 }
 
 
+static void
+freeinputbuf(struct parsefile* pf)
+{
+	if (pf->buf != NULL && pf->buf != basebuf)
+		ckfree(pf->buf);
+	pf->buf = NULL;
+}
+
+
 /*
  * Return current file (to go back to it later using popfilesupto()).
  */
@@ -44,6 +44,13 @@
 struct alias;
 struct parsefile;
 
+/* A position in an input file at which parsing can be resumed. */
+struct inputpos
+{
+	int64_t offset;		/* file offset */
+	int32_t linno;		/* line number there */
+};
+
 void resetinput(void);
 int32_t pgetc(void);
 int32_t preadbuffer(void);
@@ -52,6 +59,8 @@ void pungetc(void);
 void pushstring(const_cstring_t, size_t len, struct alias*);
 void setinputfile(const_cstring_t, int32_t);
 void setinputfd(int32_t, int32_t);
+int32_t getinputpos(struct inputpos*);
+void setinputpos(const struct inputpos*);
 void setinputstring(const_cstring_t, int32_t);
 void popfile(void);
 struct parsefile* getcurrentfile(void);
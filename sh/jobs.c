@@ -45,6 +45,18 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
+#if defined(_POSIX_SPAWN) && _POSIX_SPAWN > 0
+#include <spawn.h>
+#define SPAWN
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 35)
+#define SPAWN_TCSETPGRP		/* posix_spawn_file_actions_addtcsetpgrp_np */
+#endif
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/signalfd.h>
+#define SIGCHLDFD		/* sleep in dowait() on a signalfd for SIGCHLD */
+#endif
 
 #include "shell.h"
 #if JOBS
@@ -57,6 +69,7 @@
 #include "main.h"
 #include "parser.h"
 #include "nodes.h"
+#include "eval.h"
 #include "jobs.h"
 #include "options.h"
 #include "trap.h"
@@ -72,6 +85,52 @@
 
 static struct job* jobtab;	/* array of jobs */
 static size_t njobs;		/* size of array */
+static size_t nfreejobs;	/* number of unused entries in jobtab */
+static size_t jobfree;		/* no unused entries below this index */
+static size_t nrunjobs;		/* number of jobs with state 0 */
+static size_t ndonejobs;	/* number of jobs with state JOBDONE */
+
+/*
+ * A non-interactive shell keeps finished background jobs until they are
+ * waited for, so that "wait -n" and "pool" see their status, but no more
+ * than this many, so that a script that never waits does not fill the job
+ * table.  Jobs that $! referred to are kept whatever their number, as
+ * before.  The finished jobs that have not been waited for are on two
+ * lists in the order they finished, so that neither "wait -n" nor making
+ * room for another job has to search the job table.
+ */
+#define JOBKEEPMAX	1024
+
+struct joblist
+{
+	struct job* first;
+	struct job* last;
+	size_t count;
+};
+
+static struct joblist donejobs;		/* finished, not waited for */
+static struct joblist rememberedjobs;	/* the same, but $! referenced */
+
+/*
+ * Processes that have not terminated, hashed by pid, so that dowait()
+ * does not have to look through every job for the one a pid belongs to.
+ * The job and process are kept as indices because jobtab is relocated
+ * when it grows.
+ */
+struct pident
+{
+	struct pident* next;
+	pid_t pid;
+	int32_t job;		/* index in jobtab */
+	int32_t proc;		/* index in the job's ps array */
+};
+
+#define PIDTABMIN	64
+
+static struct pident** pidtab;	/* hash buckets */
+static size_t pidtabsize;	/* number of buckets, a power of two */
+static size_t npids;		/* number of entries */
+
 static pid_t backgndpid = -1;	/* pid of last background process */
 static struct job* bgjob = NULL; /* last background process */
 #if JOBS
@@ -79,6 +138,11 @@ static struct job* jobmru;	/* most recently used job list */
 static pid_t initialpgrp;	/* pgrp of shell on invocation */
 #endif
 static int32_t ttyfd = -1;
+#ifdef SIGCHLDFD
+static int32_t sigchldfd = -1;	/* -2 if it could not be created */
+#endif
+int32_t forkmode = FORKMODE_VFORK;
+static long jobtimes = -1;	/* SH_JOBTIMES in milliseconds, or -1 */
 
 /* mode flags for dowait */
 #define DOWAIT_BLOCK	0x1 /* wait until a child exits */
@@ -89,7 +153,18 @@ static int32_t ttyfd = -1;
 static void restartjob(struct job*);
 #endif
 static void freejob(struct job*);
+static void setjobstate(struct job*, int32_t);
+static void addpid(struct job*, int32_t);
+static struct pident** findpid(pid_t);
+static void delpid(pid_t, struct job*);
 static int32_t waitcmdloop(struct job*);
+static void blockwaitsigs(void);
+static void unblockwaitsigs(void);
+static int32_t waitnextjob(int32_t);
+static void listjob(struct joblist*, struct job*);
+static void unlistjob(struct job*);
+static struct job* getdonejob(void);
+static void freeoldjob(void);
 static struct job* getjob_nonotfound(const_cstring_t);
 static struct job* getjob(const_cstring_t);
 int32_t killjob(const_cstring_t, int32_t);
@@ -104,6 +179,10 @@ static struct job* getcurjob(struct job*);
 #endif
 static void printjobcmd(struct job*);
 static void showjob(struct job*, int32_t);
+static struct procstat* addproc(struct job*, pid_t);
+static cstring_t argvtext(cstring_t*);
+static long tvdiff(const struct timeval*, const struct timeval*);
+static void showusage(struct job*, struct output*);
 
 
 /*
@@ -280,7 +359,7 @@ restartjob(struct job* jp)
 		if (WIFSTOPPED(ps->status))
 		{
 			ps->status = -1;
-			jp->state = 0;
+			setjobstate(jp, 0);
 		}
 	}
 	INTON;
@@ -296,7 +375,7 @@ jobscmd(int32_t argc __unused, cstring_t argv[] __unused)
 	(void)argc; (void)argv;
 
 	mode = SHOWJOBS_DEFAULT;
-	while ((ch = nextopt("lps")) != '\0')
+	while ((ch = nextopt("lpst")) != '\0')
 	{
 		switch (ch)
 		{
@@ -309,8 +388,13 @@ jobscmd(int32_t argc __unused, cstring_t argv[] __unused)
 			case 's':
 				mode = SHOWJOBS_PIDS;
 				break;
+			case 't':
+				mode = SHOWJOBS_USAGE;
+				break;
 		}
 	}
+	if (mode == SHOWJOBS_USAGE)
+		showusage(NULL, out1);
 	if (*argptr == NULL)
 		showjobs(0, mode);
 	else
@@ -345,6 +429,11 @@ showjob(struct job* jp, int32_t mode)
 	size_t col, curr;
 	size_t jobno, prev, procno;
 	char c;
+	if (mode == SHOWJOBS_USAGE)
+	{
+		showusage(jp, out1);
+		return;
+	}
 	procno = (mode == SHOWJOBS_PGIDS) ? 1 : jp->nprocs;
 	jobno = jp - jobtab + 1;
 	curr = prev = 0;
@@ -491,6 +580,162 @@ showjobs(int32_t change, int32_t mode)
 }
 
 
+/*
+ * Enter the process jp->ps[proc] in the pid index.
+ */
+
+static void
+addpid(struct job* jp, int32_t proc)
+{
+	struct pident* pe;
+	struct pident** newtab;
+	struct pident* next;
+	size_t i, newsize;
+
+	INTOFF;
+	if (npids >= pidtabsize)
+	{
+		newsize = pidtabsize == 0 ? PIDTABMIN : pidtabsize * 2;
+		newtab = ckmalloctag(newsize * sizeof newtab[0], MT_JOB);
+		memset(newtab, 0, newsize * sizeof newtab[0]);
+		for (i = 0 ; i < pidtabsize ; i++)
+		{
+			for (pe = pidtab[i] ; pe != NULL ; pe = next)
+			{
+				next = pe->next;
+				pe->next = newtab[(size_t)pe->pid & (newsize - 1)];
+				newtab[(size_t)pe->pid & (newsize - 1)] = pe;
+			}
+		}
+		if (pidtab != NULL)
+			ckfree(pidtab);
+		pidtab = newtab;
+		pidtabsize = newsize;
+	}
+	pe = ckmalloctag(sizeof *pe, MT_JOB);
+	pe->pid = jp->ps[proc].pid;
+	pe->job = (int32_t)(jp - jobtab);
+	pe->proc = proc;
+	pe->next = pidtab[(size_t)pe->pid & (pidtabsize - 1)];
+	pidtab[(size_t)pe->pid & (pidtabsize - 1)] = pe;
+	npids++;
+	INTON;
+}
+
+
+/*
+ * Find the entry for a pid in the pid index.  Returns the link pointing
+ * to it, so that the caller can unlink it, or NULL.
+ */
+
+static struct pident**
+findpid(pid_t pid)
+{
+	struct pident** pp;
+
+	if (npids == 0)
+		return NULL;
+	for (pp = &pidtab[(size_t)pid & (pidtabsize - 1)] ; *pp != NULL ;
+			pp = &(*pp)->next)
+	{
+		if ((*pp)->pid == pid)
+			return pp;
+	}
+	return NULL;
+}
+
+
+/*
+ * Remove a pid from the index if it is there on behalf of the given job;
+ * the pid may have been reused by a process of another job.
+ */
+
+static void
+delpid(pid_t pid, struct job* jp)
+{
+	struct pident** pp;
+	struct pident* pe;
+
+	if ((pp = findpid(pid)) == NULL || (*pp)->job != jp - jobtab)
+		return;
+	INTOFF;
+	pe = *pp;
+	*pp = pe->next;
+	ckfree(pe);
+	npids--;
+	INTON;
+}
+
+
+/*
+ * Change the state of a job, keeping count of running and done jobs.
+ */
+
+static void
+setjobstate(struct job* jp, int32_t state)
+{
+	if (jp->state == 0)
+		nrunjobs--;
+	else if (jp->state == JOBDONE)
+	{
+		ndonejobs--;
+		unlistjob(jp);
+	}
+	if (state == 0)
+		nrunjobs++;
+	else if (state == JOBDONE)
+	{
+		ndonejobs++;
+		listjob(jp->remembered ? &rememberedjobs : &donejobs, jp);
+	}
+	jp->state = state;
+}
+
+
+/*
+ * Add a finished job at the end of a list.
+ */
+
+static void
+listjob(struct joblist* list, struct job* jp)
+{
+	jp->donelist = list;
+	jp->donenext = NULL;
+	jp->doneprev = list->last;
+	if (list->last != NULL)
+		list->last->donenext = jp;
+	else
+		list->first = jp;
+	list->last = jp;
+	list->count++;
+}
+
+
+/*
+ * Take a job off the list of finished jobs it is on, if any.
+ */
+
+static void
+unlistjob(struct job* jp)
+{
+	struct joblist* list = jp->donelist;
+	if (list == NULL)
+		return;
+	if (jp->doneprev != NULL)
+		jp->doneprev->donenext = jp->donenext;
+	else
+		list->first = jp->donenext;
+	if (jp->donenext != NULL)
+		jp->donenext->doneprev = jp->doneprev;
+	else
+		list->last = jp->doneprev;
+	list->count--;
+	jp->donelist = NULL;
+	jp->donenext = NULL;
+	jp->doneprev = NULL;
+}
+
+
 /*
  * Mark a job structure as unused.
  */
@@ -505,12 +750,22 @@ freejob(struct job* jp)
 		bgjob = NULL;
 	for (i = jp->nprocs, ps = jp->ps ; --i >= 0 ; ps++)
 	{
+		if (ps->status == -1 || WIFSTOPPED(ps->status))
+			delpid(ps->pid, jp);
 		if (ps->cmd != nullstr)
 			ckfree(ps->cmd);
 	}
 	if (jp->ps != &jp->ps0)
 		ckfree(jp->ps);
+	if (jp->state == 0)
+		nrunjobs--;
+	else if (jp->state == JOBDONE)
+		ndonejobs--;
+	unlistjob(jp);
 	jp->used = 0;
+	nfreejobs++;
+	if ((size_t)(jp - jobtab) < jobfree)
+		jobfree = jp - jobtab;
 #if JOBS
 	deljob(jp);
 #endif
@@ -524,9 +779,14 @@ waitcmd(int32_t argc __unused, cstring_t* argv __unused)
 {
 	struct job* job;
 	int32_t retval;
+	int32_t next;
 	(void)argc; (void)argv;
 
-	nextopt("");
+	next = 0;
+	while (nextopt("n") != '\0')
+		next = 1;
+	if (next)
+		return (waitnextjob(DOWAIT_BLOCK));
 	if (*argptr == NULL)
 		return (waitcmdloop(NULL));
 	do
@@ -549,8 +809,9 @@ waitcmdloop(struct job* job)
 	struct job* jp;
 	/*
 	 * Loop until a process is terminated or stopped, or a SIGINT is
-	 * received.
+	 * received.  Signals stay blocked from one wait to the next.
 	 */
+	blockwaitsigs();
 	do
 	{
 		if (job != NULL)
@@ -567,15 +828,16 @@ waitcmdloop(struct job* job)
 				else
 				{
 					job->remembered = 0;
+					unlistjob(job);
 					if (job == bgjob)
 						bgjob = NULL;
 				}
-				return retval;
+				goto out;
 			}
 		}
 		else
 		{
-			for (jp = jobtab ; jp < jobtab + njobs; jp++)
+			for (jp = jobtab ; ndonejobs > 0 && jp < jobtab + njobs; jp++)
 				if (jp->used && jp->state == JOBDONE)
 				{
 					if (! iflag || ! jp->changed)
@@ -583,28 +845,168 @@ waitcmdloop(struct job* job)
 					else
 					{
 						jp->remembered = 0;
+						unlistjob(jp);
 						if (jp == bgjob)
 							bgjob = NULL;
 					}
 				}
-			for (jp = jobtab ; ; jp++)
+			if (nrunjobs == 0)  	/* no running procs */
 			{
-				if (jp >= jobtab + njobs)  	/* no running procs */
-				{
-					return 0;
-				}
-				if (jp->used && jp->state == 0)
-					break;
+				retval = 0;
+				goto out;
 			}
 		}
 	}
-	while (dowait(DOWAIT_BLOCK | DOWAIT_SIG, (struct job*)NULL) != -1);
+	while (dowait(DOWAIT_BLOCK | DOWAIT_SIG, job) != -1);
+	sig = pendingsig_waitcmd;
+	pendingsig_waitcmd = 0;
+	retval = sig + 128;
+out:
+	unblockwaitsigs();
+	return retval;
+}
+
+
+/*
+ * Return a job that has finished but has not been waited for, if any.
+ */
+
+static struct job*
+getdonejob(void)
+{
+	if (donejobs.first != NULL)
+		return donejobs.first;
+	return rememberedjobs.first;
+}
+
+
+/*
+ * Make room for another finished job by freeing the oldest one that has
+ * not been waited for, other than those $! refers to.
+ */
+
+static void
+freeoldjob(void)
+{
+	struct job* jp;
+
+	jp = donejobs.first;
+	if (jp != NULL && jp == bgjob)
+		jp = jp->donenext;
+	if (jp != NULL)
+		freejob(jp);
+}
+
+
+/*
+ * Wait for any job to finish, remove it from the job table and return its
+ * exit status, as "wait -n" does.  A job that finished earlier and has not
+ * been waited for is taken first.  If there is no job to wait for, returns
+ * 127; without DOWAIT_BLOCK in mode, returns -1 then and also when no job
+ * has finished yet.
+ */
+
+static int32_t
+waitnextjob(int32_t mode)
+{
+	struct job* jp;
+	int32_t status, sig;
+
+	for (;;)
+	{
+		if ((jp = getdonejob()) != NULL)
+		{
+			status = jp->ps[jp->nprocs - 1].status;
+			freejob(jp);
+			if (WIFEXITED(status))
+				return WEXITSTATUS(status);
+			return WTERMSIG(status) + 128;
+		}
+		if (nrunjobs == 0)
+			return (mode & DOWAIT_BLOCK) != 0 ? 127 : -1;
+		if ((mode & DOWAIT_BLOCK) == 0)
+		{
+			if (dowait(0, NULL) <= 0)
+				return -1;
+		}
+		else if (dowait(DOWAIT_BLOCK | DOWAIT_SIG, NULL) == -1)
+			break;
+	}
 	sig = pendingsig_waitcmd;
 	pendingsig_waitcmd = 0;
 	return sig + 128;
 }
 
 
+/*
+ * Run a command in the background once fewer than a given number of jobs
+ * are running.  The exit status is that of a job that has finished, which
+ * is removed from the job table as by "wait -n", or 0 if none has.
+ */
+
+int32_t
+poolcmd(int32_t argc __unused, cstring_t* argv __unused)
+{
+	struct job* jp;
+	cstring_t p;
+	cstring_t concat;
+	cstring_t* ap;
+	long max;
+	int32_t status;
+	(void)argc; (void)argv;
+
+	max = 0;
+	while (nextopt("j:") != '\0')
+	{
+		if (! is_number(shoptarg) || (max = number(shoptarg)) <= 0)
+			sherror("Illegal number: %s", shoptarg);
+	}
+	if (max == 0)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		max = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (max <= 0)
+			max = 1;
+	}
+	/* Collect a job that has finished, then wait for a free slot. */
+	status = waitnextjob(0);
+	while (nrunjobs >= (size_t)max)
+	{
+		errno = 0;
+		status = waitnextjob(DOWAIT_BLOCK);
+		if (int_pending())
+			return status;
+		if (errno == ECHILD)	/* no children left to wait for */
+			break;
+	}
+	if (status == -1)
+		status = 0;
+	if ((p = *argptr) == NULL)
+		return status;
+	if (argptr[1] != NULL)
+	{
+		STARTSTACKSTR(concat);
+		ap = argptr + 1;
+		for (;;)
+		{
+			STPUTS(p, concat);
+			if ((p = *ap++) == NULL)
+				break;
+			STPUTC(' ', concat);
+		}
+		STPUTC('\0', concat);
+		p = grabstackstr(concat);
+	}
+	jp = makejob(NULL, 1);
+	if (forkshell(jp, NULL, FORK_BG) == 0)
+		evalstring(p, EV_EXIT);		/* never returns */
+	if (iflag && rootshell)
+		jp->ps[0].cmd = savestrtag(p, MT_JOB);
+	return status;
+}
+
+
 
 int32_t
 jobidcmd(int32_t argc __unused, cstring_t* argv __unused)
@@ -637,6 +1039,7 @@ getjob_nonotfound(const_cstring_t name)
 	size_t namelen;
 	pid_t pid;
 	size_t i;
+	struct pident** pp;
 	if (name == NULL)
 	{
 #if JOBS
@@ -713,6 +1116,12 @@ currentjob:
 	else if (is_number(name))
 	{
 		pid = (pid_t)number(name);
+		if ((pp = findpid(pid)) != NULL)
+		{
+			jp = &jobtab[(*pp)->job];
+			if ((*pp)->proc == jp->nprocs - 1)
+				return jp;
+		}
 		for (jp = jobtab, i = njobs ; i-- > 0; jp++)
 		{
 			if (jp->used && jp->nprocs > 0
@@ -767,67 +1176,97 @@ killjob(const_cstring_t name, int32_t sig)
 struct job*
 makejob(union node* node __unused, int32_t nprocs)
 {
-	size_t i;
+	size_t i, newsize;
 	struct job* jp;
 	(void)node;
 
-	for (i = njobs, jp = jobtab ; ; jp++)
+	if (nfreejobs == 0)
 	{
-		if (i-- == 0)
+		/* Grow the table geometrically; job numbers are indices. */
+		INTOFF;
+		newsize = njobs < 4 ? 4 : njobs * 2;
+		if (njobs == 0)
 		{
-			INTOFF;
-			if (njobs == 0)
-			{
-				jobtab = ckmalloc(4 * sizeof jobtab[0]);
+			jobtab = ckmalloctag(newsize * sizeof jobtab[0], MT_JOB);
 #if JOBS
-				jobmru = NULL;
+			jobmru = NULL;
 #endif
-			}
-			else
-			{
-				jp = ckmalloc((njobs + 4) * sizeof jobtab[0]);
-				memcpy(jp, jobtab, njobs * sizeof jp[0]);
+		}
+		else
+		{
+			jp = ckmalloctag(newsize * sizeof jobtab[0], MT_JOB);
+			memcpy(jp, jobtab, njobs * sizeof jp[0]);
 #if JOBS
-				/* Relocate `next' pointers and list head */
-				if (jobmru != NULL)
-					jobmru = &jp[jobmru - jobtab];
-				for (i = 0; i < njobs; i++)
-					if (jp[i].next != NULL)
-						jp[i].next = &jp[jp[i].next -
-										 jobtab];
+			/* Relocate `next' and `prev' pointers and list head */
+			if (jobmru != NULL)
+				jobmru = &jp[jobmru - jobtab];
+			for (i = 0; i < njobs; i++)
+			{
+				if (jp[i].next != NULL)
+					jp[i].next = &jp[jp[i].next -
+									 jobtab];
+				if (jp[i].prev != NULL)
+					jp[i].prev = &jp[jp[i].prev -
+									 jobtab];
+			}
 #endif
-				if (bgjob != NULL)
-					bgjob = &jp[bgjob - jobtab];
-				/* Relocate `ps' pointers */
-				for (i = 0; i < njobs; i++)
-					if (jp[i].ps == &jobtab[i].ps0)
-						jp[i].ps = &jp[i].ps0;
-				ckfree(jobtab);
-				jobtab = jp;
+			if (bgjob != NULL)
+				bgjob = &jp[bgjob - jobtab];
+			/* and the lists of finished jobs */
+			for (i = 0; i < njobs; i++)
+			{
+				if (jp[i].donenext != NULL)
+					jp[i].donenext = &jp[jp[i].donenext - jobtab];
+				if (jp[i].doneprev != NULL)
+					jp[i].doneprev = &jp[jp[i].doneprev - jobtab];
 			}
-			jp = jobtab + njobs;
-			for (i = 4 ; i-- > 0 ; jobtab[njobs++].used = 0)
-				;
-			INTON;
-			break;
+			if (donejobs.first != NULL)
+			{
+				donejobs.first = &jp[donejobs.first - jobtab];
+				donejobs.last = &jp[donejobs.last - jobtab];
+			}
+			if (rememberedjobs.first != NULL)
+			{
+				rememberedjobs.first = &jp[rememberedjobs.first - jobtab];
+				rememberedjobs.last = &jp[rememberedjobs.last - jobtab];
+			}
+			/* Relocate `ps' pointers */
+			for (i = 0; i < njobs; i++)
+				if (jp[i].ps == &jobtab[i].ps0)
+					jp[i].ps = &jp[i].ps0;
+			ckfree(jobtab);
+			jobtab = jp;
 		}
-		if (jp->used == 0)
-			break;
+		jobfree = njobs;
+		nfreejobs = newsize - njobs;
+		for ( ; njobs < newsize ; jobtab[njobs++].used = 0)
+			;
+		INTON;
 	}
+	/* Reuse the lowest job number, as the linear search used to. */
+	for (jp = jobtab + jobfree ; jp->used ; jp++)
+		;
 	INTOFF;
+	jobfree = jp - jobtab + 1;
+	nfreejobs--;
 	jp->state = 0;
+	nrunjobs++;
 	jp->used = 1;
 	jp->changed = 0;
 	jp->nprocs = 0;
 	jp->foreground = 0;
 	jp->remembered = 0;
+	jp->donelist = NULL;
+	jp->donenext = NULL;
+	jp->doneprev = NULL;
 #if JOBS
 	jp->jobctl = jobctl;
 	jp->next = NULL;
+	jp->prev = NULL;
 #endif
 	if (nprocs > 1)
 	{
-		jp->ps = ckmalloc(nprocs * sizeof(struct procstat));
+		jp->ps = ckmalloctag(nprocs * sizeof(struct procstat), MT_JOB);
 	}
 	else
 	{
@@ -843,39 +1282,28 @@ makejob(union node* node __unused, int32_t nprocs)
 static void
 setcurjob(struct job* cj)
 {
-	struct job* jp, *prev;
-	for (prev = NULL, jp = jobmru; jp != NULL; prev = jp, jp = jp->next)
-	{
-		if (jp == cj)
-		{
-			if (prev != NULL)
-				prev->next = jp->next;
-			else
-				jobmru = jp->next;
-			jp->next = jobmru;
-			jobmru = cj;
-			return;
-		}
-	}
+	if (cj == jobmru)
+		return;
+	deljob(cj);
 	cj->next = jobmru;
+	if (jobmru != NULL)
+		jobmru->prev = cj;
 	jobmru = cj;
 }
 
 static void
 deljob(struct job* j)
 {
-	struct job* jp, *prev;
-	for (prev = NULL, jp = jobmru; jp != NULL; prev = jp, jp = jp->next)
-	{
-		if (jp == j)
-		{
-			if (prev != NULL)
-				prev->next = jp->next;
-			else
-				jobmru = jp->next;
-			return;
-		}
-	}
+	if (j->prev != NULL)
+		j->prev->next = j->next;
+	else if (j == jobmru)
+		jobmru = j->next;
+	else
+		return;		/* not on the list */
+	if (j->next != NULL)
+		j->next->prev = j->prev;
+	j->next = NULL;
+	j->prev = NULL;
 }
 
 /*
@@ -945,6 +1373,7 @@ forkshell(struct job* jp, union node* n, int32_t mode)
 		INTON;
 		forcelocal = 0;
 		clear_traps();
+		forgetpathwatch();
 #if JOBS
 		jobctl = 0;		/* do job control only in root shell */
 		if (wasroot && mode != FORK_NOJOB && mflag)
@@ -1014,19 +1443,15 @@ forkshell(struct job* jp, union node* n, int32_t mode)
 	}
 	if (mode == FORK_BG)
 	{
-		if (bgjob != NULL && bgjob->state == JOBDONE &&
-				!bgjob->remembered && !iflag)
-			freejob(bgjob);
+		if (!iflag && donejobs.count >= JOBKEEPMAX)
+			freeoldjob();
 		backgndpid = pid;		/* set $! */
 		bgjob = jp;
 	}
 	if (jp)
 	{
-		struct procstat* ps = &jp->ps[jp->nprocs++];
-		ps->pid = pid;
-		ps->status = -1;
-		ps->cmd = nullstr;
-		if (iflag && rootshell && n)
+		struct procstat* ps = addproc(jp, pid);
+		if (((iflag && rootshell) || jobtimes >= 0) && n)
 			ps->cmd = commandtext(n);
 		jp->foreground = mode == FORK_FG;
 #if JOBS
@@ -1040,7 +1465,7 @@ forkshell(struct job* jp, union node* n, int32_t mode)
 
 
 pid_t
-vforkexecshell(struct job* jp, cstring_t* argv, cstring_t* envp, const_cstring_t path, int32_t idx, int32_t pip[2])
+vforkexecshell(struct job* jp, cstring_t* argv, cstring_t* envp, const_cstring_t path, int32_t idx, int32_t prevfd, int32_t pip[2])
 {
 	pid_t pid;
 	struct jmploc jmploc;
@@ -1062,9 +1487,15 @@ vforkexecshell(struct job* jp, cstring_t* argv, cstring_t* envp, const_cstring_t
 		TRACE(("Child shell %d\n", (int32_t)getpid()));
 		if (setjmp(jmploc.loc))
 			_exit(exception == EXEXEC ? exerrno : 2);
+		if (prevfd > 0)
+		{
+			dup2(prevfd, 0);
+			close(prevfd);
+		}
 		if (pip != NULL)
 		{
-			close(pip[0]);
+			if (!(prevfd >= 0 && pip[0] == 0))
+				close(pip[0]);
 			if (pip[1] != 1)
 			{
 				dup2(pip[1], 1);
@@ -1077,10 +1508,9 @@ vforkexecshell(struct job* jp, cstring_t* argv, cstring_t* envp, const_cstring_t
 	handler = savehandler;
 	if (jp)
 	{
-		struct procstat* ps = &jp->ps[jp->nprocs++];
-		ps->pid = pid;
-		ps->status = -1;
-		ps->cmd = nullstr;
+		struct procstat* ps = addproc(jp, pid);
+		if (jobtimes >= 0)
+			ps->cmd = argvtext(argv);
 		jp->foreground = 1;
 #if JOBS
 		setcurjob(jp);
@@ -1091,6 +1521,261 @@ vforkexecshell(struct job* jp, cstring_t* argv, cstring_t* envp, const_cstring_t
 	return pid;
 }
 
+/*
+ * Set the way external commands are started from the value of
+ * SH_FORKMODE.  Unknown values select the default.
+ */
+
+void
+setforkmode(const_cstring_t val)
+{
+	if (strcmp(val, "fork") == 0)
+		forkmode = FORKMODE_FORK;
+	else if (strcmp(val, "spawn") == 0)
+		forkmode = FORKMODE_SPAWN;
+	else
+		forkmode = FORKMODE_VFORK;
+}
+
+
+/*
+ * Called when SH_JOBTIMES changes.  The value is a number of seconds;
+ * foreground jobs that take at least that long have their resource usage
+ * reported on standard error.
+ */
+
+void
+setjobtimes(const_cstring_t val)
+{
+	long ms;
+	long scale;
+
+	if (*val == '\0')
+	{
+		jobtimes = -1;
+		return;
+	}
+	for (ms = 0 ; is_digit(*val) && ms < 1000000000L ; val++)
+		ms = ms * 10 + (*val - '0') * 1000;
+	for (; is_digit(*val) ; val++)
+		;
+	if (*val == '.')
+		for (scale = 100, val++ ; is_digit(*val) ; val++, scale /= 10)
+			ms += (*val - '0') * scale;
+	jobtimes = ms;
+}
+
+
+#ifdef SPAWN
+/*
+ * Add the file actions for a redirection list.  Returns -1 for
+ * redirections that need the shell in the child.
+ */
+
+static int32_t
+spawnredir(posix_spawn_file_actions_t* fa, union node* redir)
+{
+	int32_t fd;
+	int32_t oflags;
+	for (; redir ; redir = redir->nfile.next)
+	{
+		fd = redir->nfile.fd;
+		switch (redir->type)
+		{
+			case NFROM:
+				oflags = O_RDONLY;
+				break;
+			case NFROMTO:
+				oflags = O_RDWR | O_CREAT;
+				break;
+			case NTO:
+				if (Cflag)
+					return -1;
+				/* FALLTHROUGH */
+			case NCLOBBER:
+				oflags = O_WRONLY | O_CREAT | O_TRUNC;
+				break;
+			case NAPPEND:
+				oflags = O_WRONLY | O_CREAT | O_APPEND;
+				break;
+			case NTOFD:
+			case NFROMFD:
+				if (redir->ndup.dupfd < 0)
+				{
+					if (posix_spawn_file_actions_addclose(fa, fd) != 0)
+						return -1;
+				}
+				else if (redir->ndup.dupfd == fd)
+				{
+					/* n>&n on a closed n is left to redirect() */
+					if (fcntl(fd, F_GETFD) < 0)
+						return -1;
+				}
+				else if (posix_spawn_file_actions_adddup2(fa,
+								redir->ndup.dupfd, fd) != 0)
+					return -1;
+				continue;
+			default:
+				return -1;
+		}
+		if (posix_spawn_file_actions_addopen(fa, fd,
+				redir->nfile.expfname, oflags, 0666) != 0)
+			return -1;
+	}
+	return 0;
+}
+#endif
+
+
+/*
+ * Start an external command with posix_spawn() rather than forking the
+ * shell.  Redirections become file actions, the caller passes the
+ * environment with any variable assignments applied, and the process
+ * group and terminal are set up by the spawn attributes.  Returns -1
+ * without starting anything if the command cannot be started this way
+ * (here-documents, noclobber, a script without #!, a failed redirection);
+ * the caller then forks, which also produces the usual error messages.
+ * Prevfd and pip connect the command to a pipeline, as in evalpipe().
+ */
+
+pid_t
+spawnshell(struct job* jp, union node* n, cstring_t* argv, cstring_t* envp,
+		   const_cstring_t path, int32_t idx, int32_t mode, int32_t prevfd,
+		   int32_t pip[])
+{
+#ifdef SPAWN
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	cstring_t cmdname;
+	pid_t pid;
+	pid_t pgrp;
+	int16_t sflags;
+	int32_t settty;
+	int32_t e;
+	TRACE(("spawnshell(%%%td, %s, %d) called\n", jp - jobtab, argv[0],
+		   mode));
+	if (strchr(argv[0], '/') != NULL)
+		cmdname = argv[0];
+	else
+	{
+		while ((cmdname = padvance(&path, argv[0])) != NULL)
+		{
+			if (--idx < 0 && pathopt == NULL)
+				break;
+			stunalloc(cmdname);
+		}
+		if (cmdname == NULL)
+			return -1;
+	}
+	pgrp = 0;
+	settty = 0;
+	sflags = POSIX_SPAWN_SETSIGDEF;
+	sigemptyset(&sigs);
+	if (rootshell && iflag && isshellignored(SIGTERM))
+		sigaddset(&sigs, SIGTERM);
+#if JOBS
+	if (rootshell && mode != FORK_NOJOB && mflag)
+	{
+		if (jp != NULL && jp->nprocs != 0)
+			pgrp = jp->ps[0].pid;
+		sflags |= POSIX_SPAWN_SETPGROUP;
+		if (mode == FORK_FG && ttyfd >= 0)
+		{
+#ifdef SPAWN_TCSETPGRP
+			settty = 1;
+#else
+			/* The terminal must be handed over before the exec. */
+			return -1;
+#endif
+		}
+		if (isshellignored(SIGTSTP))
+			sigaddset(&sigs, SIGTSTP);
+		if (isshellignored(SIGTTOU))
+			sigaddset(&sigs, SIGTTOU);
+	}
+#endif
+	INTOFF;
+	if (posix_spawn_file_actions_init(&fa) != 0)
+	{
+		INTON;
+		return -1;
+	}
+	if (posix_spawnattr_init(&attr) != 0)
+	{
+		posix_spawn_file_actions_destroy(&fa);
+		INTON;
+		return -1;
+	}
+	e = 0;
+	if (prevfd > 0)
+	{
+		e |= posix_spawn_file_actions_adddup2(&fa, prevfd, 0);
+		e |= posix_spawn_file_actions_addclose(&fa, prevfd);
+	}
+	if (pip != NULL)
+	{
+		if (!(prevfd >= 0 && pip[0] == 0))
+			e |= posix_spawn_file_actions_addclose(&fa, pip[0]);
+		if (pip[1] != 1)
+		{
+			e |= posix_spawn_file_actions_adddup2(&fa, pip[1], 1);
+			e |= posix_spawn_file_actions_addclose(&fa, pip[1]);
+		}
+	}
+#ifdef SPAWN_TCSETPGRP
+	if (settty)
+		e |= posix_spawn_file_actions_addtcsetpgrp_np(&fa, ttyfd);
+#endif
+	if (e == 0)
+		e = spawnredir(&fa, n->ncmd.redirect);
+	e |= posix_spawnattr_setflags(&attr, sflags);
+	e |= posix_spawnattr_setsigdefault(&attr, &sigs);
+	e |= posix_spawnattr_setpgroup(&attr, pgrp);
+	if (e == 0)
+	{
+		flushall();
+		e = posix_spawn(&pid, cmdname, &fa, &attr, argv, envp);
+	}
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	if (e != 0)
+	{
+		TRACE(("Spawn failed, errno=%d\n", e));
+		INTON;
+		return -1;
+	}
+#if JOBS
+	if (sflags & POSIX_SPAWN_SETPGROUP)
+		setpgid(pid, pgrp != 0 ? pgrp : pid);
+#endif
+	if (jp)
+	{
+		struct procstat* ps = addproc(jp, pid);
+		if (((iflag && rootshell) || jobtimes >= 0) && n)
+			ps->cmd = commandtext(n);
+		jp->foreground = mode == FORK_FG;
+#if JOBS
+		setcurjob(jp);
+#endif
+	}
+	INTON;
+	TRACE(("In parent shell:  child = %d\n", (int32_t)pid));
+	return pid;
+#else
+	(void)jp;
+	(void)n;
+	(void)argv;
+	(void)envp;
+	(void)path;
+	(void)idx;
+	(void)mode;
+	(void)prevfd;
+	(void)pip;
+	return -1;
+#endif
+}
+
 
 /*
  * Wait for job to finish.
@@ -1119,6 +1804,7 @@ waitforjob(struct job* jp, int32_t* origstatus)
 #endif
 	int32_t status;
 	int32_t st;
+	struct procstat* ps;
 	INTOFF;
 	TRACE(("waitforjob(%%%td) called\n", jp - jobtab + 1));
 	while (jp->state == 0)
@@ -1146,6 +1832,19 @@ waitforjob(struct job* jp, int32_t* origstatus)
 #endif
 	else
 		st = WTERMSIG(status) + 128;
+	if (jobtimes >= 0 && rootshell && jp->state == JOBDONE)
+	{
+		/* Report the job if it took at least SH_JOBTIMES. */
+		for (ps = jp->ps ; ps < jp->ps + jp->nprocs ; ps++)
+			if (tvdiff(&jp->ps[0].start, &ps->end) >= jobtimes)
+				break;
+		if (ps < jp->ps + jp->nprocs)
+		{
+			showusage(NULL, out2);
+			showusage(jp, out2);
+			flushout(out2);
+		}
+	}
 	if (! JOBS || jp->state == JOBDONE)
 		freejob(jp);
 	if (int_pending())
@@ -1169,6 +1868,97 @@ dummy_handler(int32_t sig __unused)
 	(void)sig;
 }
 
+#ifdef SIGCHLDFD
+/*
+ * Return a signalfd that is readable while SIGCHLD is pending, or -1.
+ * SIGCHLD must be blocked while it is used.  Like ttyfd, it is kept out
+ * of the way of the user's redirections.
+ */
+
+static int32_t
+getsigchldfd(void)
+{
+	sigset_t chld;
+	int32_t fd;
+
+	if (sigchldfd == -1)
+	{
+		sigemptyset(&chld);
+		sigaddset(&chld, SIGCHLD);
+		fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (fd >= 0 && fd < 10)
+		{
+			sigchldfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+			close(fd);
+		}
+		else
+			sigchldfd = fd;
+		if (sigchldfd < 0)
+			sigchldfd = -2;
+	}
+	return sigchldfd < 0 ? -1 : sigchldfd;
+}
+#endif
+
+/*
+ * Block signals for dowait(DOWAIT_SIG), which sleeps with the original
+ * mask so that a child's exit or a signal ends the sleep.  A caller that
+ * waits for several children in a row may block them once around the
+ * loop; the calls nest.
+ */
+
+static struct
+{
+	int32_t depth;
+	sigset_t omask;			/* mask to sleep with */
+	int32_t restore_sigchld;	/* dummy SIGCHLD handler installed */
+	struct sigaction osa;		/* SIGCHLD action it replaced */
+	int32_t fd;			/* signalfd for SIGCHLD, or -1 */
+} waitsigs;
+
+static void
+blockwaitsigs(void)
+{
+	sigset_t mask;
+	struct sigaction sa;
+
+	if (waitsigs.depth++ > 0)
+		return;
+	sigfillset(&mask);
+	sigprocmask(SIG_BLOCK, &mask, &waitsigs.omask);
+	INTOFF;
+	waitsigs.restore_sigchld = 0;
+	waitsigs.fd = -1;
+	if (!issigchldtrapped())
+	{
+#ifdef SIGCHLDFD
+		/*
+		 * SIGCHLD stays blocked and marks the signalfd readable,
+		 * so no handler needs to be installed.
+		 */
+		if ((waitsigs.fd = getsigchldfd()) < 0)
+#endif
+		{
+			waitsigs.restore_sigchld = 1;
+			sa.sa_handler = dummy_handler;
+			sa.sa_flags = 0;
+			sigemptyset(&sa.sa_mask);
+			sigaction(SIGCHLD, &sa, &waitsigs.osa);
+		}
+	}
+}
+
+static void
+unblockwaitsigs(void)
+{
+	if (--waitsigs.depth > 0)
+		return;
+	if (waitsigs.restore_sigchld)
+		sigaction(SIGCHLD, &waitsigs.osa, NULL);
+	sigprocmask(SIG_SETMASK, &waitsigs.omask, NULL);
+	INTON;
+}
+
 /*
  * Wait for a process to terminate.
  */
@@ -1176,37 +1966,29 @@ dummy_handler(int32_t sig __unused)
 static pid_t
 dowait(int32_t mode, struct job* job)
 {
-	struct sigaction sa, osa;
-	sigset_t mask, omask;
 	pid_t pid;
 	int32_t status;
 	struct procstat* sp;
 	struct job* jp;
 	struct job* thisjob;
+	struct pident** pp;
+	struct pident* pe;
 	const_cstring_t sigstr;
 	int32_t done;
 	int32_t stopped;
 	int32_t sig;
 	int32_t coredump;
 	int32_t wflags;
-	int32_t restore_sigchld;
+	struct rusage ru;
+#ifdef SIGCHLDFD
+	struct pollfd pfd;
+	struct signalfd_siginfo si;
+	sigset_t mask;
+#endif
 
 	TRACE(("dowait(%d, %p) called\n", mode, job));
-	restore_sigchld = 0;
 	if ((mode & DOWAIT_SIG) != 0)
-	{
-		sigfillset(&mask);
-		sigprocmask(SIG_BLOCK, &mask, &omask);
-		INTOFF;
-		if (!issigchldtrapped())
-		{
-			restore_sigchld = 1;
-			sa.sa_handler = dummy_handler;
-			sa.sa_flags = 0;
-			sigemptyset(&sa.sa_mask);
-			sigaction(SIGCHLD, &sa, &osa);
-		}
-	}
+		blockwaitsigs();
 	do
 	{
 #if JOBS
@@ -1218,13 +2000,8 @@ dowait(int32_t mode, struct job* job)
 		if ((mode & (DOWAIT_BLOCK | DOWAIT_SIG)) != DOWAIT_BLOCK)
 			wflags |= WNOHANG;
 
-		// marked as legacy
-		// pid_t wait3 (int *stat_loc, int options, struct rusage *resource_usage);
-		// wait3(stat_loc, options, resource_usage); is equivalent to the call:
-		// waitpid((pid_t)-1, stat_loc, options);
-
-		// pid = wait3(&status, wflags, (struct rusage*)NULL);
-		pid = waitpid((pid_t)-1, &status, wflags);
+		/* wait3() is waitpid(-1, ...) that also returns the usage */
+		pid = wait3(&status, wflags, &ru);
 		TRACE(("wait returns %d, status=%d\n", (int32_t)pid, status));
 		if (pid == 0 && (mode & DOWAIT_SIG) != 0)
 		{
@@ -1235,72 +2012,86 @@ dowait(int32_t mode, struct job* job)
 				errno = EINTR;
 				break;
 			}
-			sigsuspend(&omask);
+#ifdef SIGCHLDFD
+			if ((pfd.fd = waitsigs.fd) >= 0)
+			{
+				/*
+				 * Sleep with the caller's mask plus SIGCHLD:
+				 * other signals interrupt as with sigsuspend().
+				 */
+				mask = waitsigs.omask;
+				sigaddset(&mask, SIGCHLD);
+				pfd.events = POLLIN;
+				if (ppoll(&pfd, 1, NULL, &mask) > 0)
+					(void)read(pfd.fd, &si, sizeof si);
+				errno = EINTR;
+			}
+			else
+#endif
+				sigsuspend(&waitsigs.omask);
 			if (int_pending())
 				break;
 		}
 	}
 	while (pid == -1 && errno == EINTR);
 	if (pid == -1 && errno == ECHILD && job != NULL)
-		job->state = JOBDONE;
+		setjobstate(job, JOBDONE);
 	if ((mode & DOWAIT_SIG) != 0)
-	{
-		if (restore_sigchld)
-			sigaction(SIGCHLD, &osa, NULL);
-		sigprocmask(SIG_SETMASK, &omask, NULL);
-		INTON;
-	}
+		unblockwaitsigs();
 	if (pid <= 0)
 		return pid;
 	INTOFF;
 	thisjob = NULL;
-	for (jp = jobtab ; jp < jobtab + njobs ; jp++)
+	if ((pp = findpid(pid)) != NULL)
 	{
-		if (jp->used && jp->nprocs > 0)
+		pe = *pp;
+		jp = &jobtab[pe->job];
+		sp = &jp->ps[pe->proc];
+		TRACE(("Changing status of proc %d from 0x%x to 0x%x\n",
+			   (int32_t)pid, sp->status, status));
+		if (WIFCONTINUED(status))
 		{
-			done = 1;
-			stopped = 1;
-			for (sp = jp->ps ; sp < jp->ps + jp->nprocs ; sp++)
-			{
-				if (sp->pid == -1)
-					continue;
-				if (sp->pid == pid && (sp->status == -1 ||
-									   WIFSTOPPED(sp->status)))
-				{
-					TRACE(("Changing status of proc %d from 0x%x to 0x%x\n",
-						   (int32_t)pid, sp->status,
-						   status));
-					if (WIFCONTINUED(status))
-					{
-						sp->status = -1;
-						jp->state = 0;
-					}
-					else
-						sp->status = status;
-					thisjob = jp;
-				}
-				if (sp->status == -1)
-					stopped = 0;
-				else if (WIFSTOPPED(sp->status))
-					done = 0;
-			}
-			if (stopped)  		/* stopped or done */
+			sp->status = -1;
+			setjobstate(jp, 0);
+		}
+		else
+			sp->status = status;
+		if (sp->status != -1 && !WIFSTOPPED(sp->status))
+		{
+			sp->ru = ru;
+			gettimeofday(&sp->end, NULL);
+			*pp = pe->next;
+			ckfree(pe);
+			npids--;
+		}
+		thisjob = jp;
+		done = 1;
+		stopped = 1;
+		for (sp = jp->ps ; sp < jp->ps + jp->nprocs ; sp++)
+		{
+			if (sp->pid == -1)
+				continue;
+			if (sp->status == -1)
+				stopped = 0;
+			else if (WIFSTOPPED(sp->status))
+				done = 0;
+		}
+		if (stopped)  		/* stopped or done */
+		{
+			int32_t state = done ? JOBDONE : JOBSTOPPED;
+			if (jp->state != state)
 			{
-				int32_t state = done ? JOBDONE : JOBSTOPPED;
-				if (jp->state != state)
+				TRACE(("Job %td: changing state from %d to %d\n", jp - jobtab + 1, jp->state, state));
+				setjobstate(jp, state);
+				if (jp != job)
 				{
-					TRACE(("Job %td: changing state from %d to %d\n", jp - jobtab + 1, jp->state, state));
-					jp->state = state;
-					if (jp != job)
-					{
-						if (done && !jp->remembered &&
-								!iflag && jp != bgjob)
-							freejob(jp);
+					if (done && !jp->remembered &&
+							!iflag && jp->foreground)
+						freejob(jp);
 #if JOBS
-						else if (done)
-							deljob(jp);
+					else if (done)
+						deljob(jp);
 #endif
-					}
 				}
 			}
 		}
@@ -1386,8 +2177,15 @@ backgndpidset(void)
 pid_t
 backgndpidval(void)
 {
-	if (bgjob != NULL && !forcelocal)
+	if (bgjob != NULL && !forcelocal && !bgjob->remembered)
+	{
 		bgjob->remembered = 1;
+		if (bgjob->donelist != NULL)
+		{
+			unlistjob(bgjob);
+			listjob(&rememberedjobs, bgjob);
+		}
+	}
 	return backgndpid;
 }
 
@@ -1400,11 +2198,107 @@ static cstring_t cmdnextc;
 static int32_t cmdnleft;
 #define MAXCMDTEXT	200
 
+/*
+ * Enter a process that has just been started in a job.
+ */
+
+static struct procstat*
+addproc(struct job* jp, pid_t pid)
+{
+	struct procstat* ps;
+
+	ps = &jp->ps[jp->nprocs++];
+	ps->pid = pid;
+	ps->status = -1;
+	ps->cmd = nullstr;
+	gettimeofday(&ps->start, NULL);
+	addpid(jp, jp->nprocs - 1);
+	return ps;
+}
+
+
+/*
+ * Milliseconds from one time to another.
+ */
+
+static long
+tvdiff(const struct timeval* from, const struct timeval* to)
+{
+	return (long)(to->tv_sec - from->tv_sec) * 1000 +
+		   (to->tv_usec - from->tv_usec) / 1000;
+}
+
+
+/*
+ * Print the resource usage of each process of a job: elapsed, user and
+ * system time, maximum resident set size and voluntary and involuntary
+ * context switches.  Only the elapsed time is known for a process that
+ * has not terminated.  With a null job, print the column headings.
+ */
+
+static void
+showusage(struct job* jp, struct output* out)
+{
+	struct procstat* ps;
+	struct timeval now;
+	char s[16];
+
+	if (jp == NULL)
+	{
+		outfmt(out, "%-5s %7s %8s %8s %8s %8s %7s %7s  %s\n", "JOB", "PID",
+			   "REAL", "USER", "SYS", "MAXRSS", "VCSW", "IVCSW", "COMMAND");
+		return;
+	}
+	gettimeofday(&now, NULL);
+	for (ps = jp->ps ; ps < jp->ps + jp->nprocs ; ps++)
+	{
+		if (ps == jp->ps)
+			fmtstr(s, 16, "[%td]", jp - jobtab + 1);
+		else
+			s[0] = '\0';
+		if (ps->status == -1 || WIFSTOPPED(ps->status))
+		{
+			outfmt(out, "%-5s %7d %8.3f %8s %8s %8s %7s %7s  %s\n", s,
+				   (int32_t)ps->pid, tvdiff(&ps->start, &now) / 1000.,
+				   "-", "-", "-", "-", "-", ps->cmd);
+			continue;
+		}
+		outfmt(out, "%-5s %7d %8.3f %8.3f %8.3f %7ldK %7ld %7ld  %s\n", s,
+			   (int32_t)ps->pid, tvdiff(&ps->start, &ps->end) / 1000.,
+			   ps->ru.ru_utime.tv_sec + ps->ru.ru_utime.tv_usec / 1000000.,
+			   ps->ru.ru_stime.tv_sec + ps->ru.ru_stime.tv_usec / 1000000.,
+			   (long)ps->ru.ru_maxrss, (long)ps->ru.ru_nvcsw,
+			   (long)ps->ru.ru_nivcsw, ps->cmd);
+	}
+}
+
+
+/*
+ * Return the words of a simple command as its command text.
+ */
+
+static cstring_t
+argvtext(cstring_t* argv)
+{
+	cstring_t name;
+	cmdnextc = name = ckmalloctag(MAXCMDTEXT, MT_JOB);
+	cmdnleft = MAXCMDTEXT - 4;
+	for (; *argv != NULL ; argv++)
+	{
+		cmdputs(*argv);
+		if (argv[1] != NULL)
+			cmdputs(" ");
+	}
+	*cmdnextc = '\0';
+	return name;
+}
+
+
 cstring_t
 commandtext(union node* n)
 {
 	cstring_t name;
-	cmdnextc = name = ckmalloc(MAXCMDTEXT);
+	cmdnextc = name = ckmalloctag(MAXCMDTEXT, MT_JOB);
 	cmdnleft = MAXCMDTEXT - 4;
 	cmdtxt(n);
 	*cmdnextc = '\0';
@@ -38,7 +38,14 @@
 #define FORK_BG 1
 #define FORK_NOJOB 2
 
+/* Ways of starting external commands, selected by SH_FORKMODE. */
+#define FORKMODE_VFORK 0	/* vfork simple commands, fork the rest */
+#define FORKMODE_FORK 1		/* always fork */
+#define FORKMODE_SPAWN 2	/* posix_spawn, fork if that is not possible */
+
 #include <signal.h>		/* for sig_atomic_t */
+#include <sys/time.h>		/* for struct timeval */
+#include <sys/resource.h>	/* for struct rusage */
 
 /*
  * A job structure contains information about a job.  A job is either a
@@ -52,6 +59,9 @@ typedef struct procstat
 	pid_t		pid;		/* process id */
 	int32_t		status;		/* status flags (defined above) */
 	cstring_t	cmd;		/* text of command being run */
+	struct timeval	start;		/* when the process was started */
+	struct timeval	end;		/* when it was reaped */
+	struct rusage	ru;		/* its resource usage, once reaped */
 } procstat_t;
 typedef procstat_t* pprocstat_t;
 
@@ -76,6 +86,10 @@ typedef struct job
 
 	uint32_t	jobctl;		/* job running under job control */
 	struct job* next;		/* job used after this one */
+	struct job* prev;		/* job used before this one */
+	struct joblist* donelist;	/* list of finished jobs it is on */
+	struct job* donenext;	/* job that finished after this one */
+	struct job* doneprev;	/* job that finished before this one */
 } job_t;
 typedef job_t* pjob_t;
 
@@ -84,16 +98,21 @@ enum
 	SHOWJOBS_DEFAULT,	/* job number, status, command */
 	SHOWJOBS_VERBOSE,	/* job number, PID, status, command */
 	SHOWJOBS_PIDS,		/* PID only */
-	SHOWJOBS_PGIDS		/* PID of the group leader only */
+	SHOWJOBS_PGIDS,		/* PID of the group leader only */
+	SHOWJOBS_USAGE		/* PID, resource usage, command */
 };
 
 extern int32_t job_warning;		/* user was warned about stopped jobs */
+extern int32_t forkmode;		/* FORKMODE_* */
 
 void setjobctl(int32_t);
 void showjobs(int32_t, int32_t);
 struct job* makejob(union node*, int32_t);
 pid_t forkshell(struct job*, union node*, int32_t);
-pid_t vforkexecshell(struct job*, cstring_t*, cstring_t*, const_cstring_t, int32_t, int32_t []);
+pid_t vforkexecshell(struct job*, cstring_t*, cstring_t*, const_cstring_t, int32_t, int32_t, int32_t []);
+pid_t spawnshell(struct job*, union node*, cstring_t*, cstring_t*, const_cstring_t, int32_t, int32_t, int32_t, int32_t []);
+void setforkmode(const_cstring_t);
+void setjobtimes(const_cstring_t);
 int32_t waitforjob(struct job*, int32_t*);
 int32_t stoppedjobs(void);
 int32_t backgndpidset(void);
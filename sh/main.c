@@ -40,6 +40,7 @@
 #include <fcntl.h>
 #include <locale.h>
 #include <errno.h>
+#include <time.h>
 
 #include "shell.h"
 #include "main.h"
@@ -62,16 +63,61 @@
 #include "cd.h"
 #include "redir.h"
 #include "builtins.h"
+#include "alias.h"
+#include "image.h"
 
 int32_t rootpid;
 int32_t rootshell;
 struct jmploc main_handler;
 int32_t localeisutf8, initial_localeisutf8;
 
+/*
+ * The commands parsed from files read with the "." command are kept,
+ * keyed by the identity, size and modification time of the file, so that
+ * sourcing the same file again evaluates the stored trees instead of
+ * reading and parsing it anew.  A file is only cached if it was read to
+ * the end without an error or a return, and an entry is only used as long
+ * as no alias has changed, since aliases are substituted by the parser.
+ * For the same reason, if a replayed command changes an alias, the rest
+ * of the file is parsed from the source again, starting at the position
+ * recorded after that command.  Files modified within the last two
+ * seconds are not cached, as a change within the same second would go
+ * unnoticed.  If a file has not been cached yet, its precompiled image is
+ * used if there is one (see image.c).
+ */
+
+#define DOTCACHESIZE	32	/* maximum number of cached files */
+
+struct dotcache
+{
+	struct dotcache* next;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	uint32_t aliasgen;	/* value of aliasgen when parsed */
+	int32_t refcount;	/* one for the cache plus running replays */
+	int32_t complete;	/* 1 if read up to EOF, -1 if not cacheable */
+	int32_t ncmds;		/* number of commands */
+	int32_t maxcmds;	/* allocated size of cmds and ends */
+	struct funcdef** cmds;	/* copies of the parsed commands */
+	struct inputpos* ends;	/* input positions after the commands */
+};
+
+static struct dotcache* dotcache;	/* most recently used first */
+static int32_t ndotcache;
+
 static void reset(void);
-static void cmdloop(int32_t);
+static void cmdloop(int32_t, struct dotcache*);
 static void read_profile(const_cstring_t);
 static cstring_t find_dot_file(cstring_t);
+static struct dotcache* dotlookup(const struct stat*);
+static struct dotcache* dotnew(const struct stat*);
+static struct dotcache* dotimage(const_cstring_t, const struct stat*);
+static void dotrecord(struct dotcache*, union node*);
+static void dotstore(struct dotcache*, const_cstring_t);
+static void dotreplay(struct dotcache*, const_cstring_t);
+static void dotunref(struct dotcache*);
 
 /*
  * Main routine.  We initialize things, parse the arguments, execute
@@ -168,7 +214,7 @@ state3:
 state4:
 	if (sflag || minusc == NULL)
 	{
-		cmdloop(1);
+		cmdloop(1, NULL);
 	}
 	exitshell(exitstatus);
 	/*NOTREACHED*/
@@ -184,11 +230,12 @@ reset(void)
 
 /*
  * Read and execute commands.  "Top" is nonzero for the top level command
- * loop; it turns on prompting if the shell is interactive.
+ * loop; it turns on prompting if the shell is interactive.  If "record" is
+ * not NULL, a copy of every command is added to it for the dot cache.
  */
 
 static void
-cmdloop(int32_t top)
+cmdloop(int32_t top, struct dotcache* record)
 {
 	union node* n;
 	struct stackmark smark;
@@ -207,11 +254,14 @@ cmdloop(int32_t top)
 			showjobs(1, SHOWJOBS_DEFAULT);
 			chkmail(0);
 			flushout(&output);
+			stacktrim();
 		}
 		n = parsecmd(inter);
 		/* showtree(n); DEBUG */
 		if (n == NEOF)
 		{
+			if (record != NULL && record->complete == 0)
+				record->complete = 1;
 			if (!top || numeof >= 50)
 				break;
 			if (!stoppedjobs())
@@ -222,7 +272,9 @@ cmdloop(int32_t top)
 			}
 			numeof++;
 		}
-		else if (n != NULL && nflag == 0)
+		else if (record != NULL && n != NULL)
+			dotrecord(record, n);
+		if (n != NEOF && n != NULL && nflag == 0)
 		{
 			job_warning = (job_warning == 2) ? 1 : 0;
 			numeof = 0;
@@ -251,16 +303,24 @@ read_profile(const_cstring_t name)
 {
 	int32_t fd;
 	const_cstring_t expandedname;
+	struct stat statb;
+	struct dotcache* dc;
 	expandedname = expandstr(name);
 	if (expandedname == NULL)
 		return;
+	if (stat(expandedname, &statb) == 0 && S_ISREG(statb.st_mode) &&
+			(dc = dotimage(expandedname, &statb)) != NULL)
+	{
+		dotreplay(dc, expandedname);
+		return;
+	}
 	INTOFF;
 	if ((fd = open(expandedname, O_RDONLY | O_CLOEXEC)) >= 0)
 		setinputfd(fd, 1);
 	INTON;
 	if (fd < 0)
 		return;
-	cmdloop(0);
+	cmdloop(0, NULL);
 	popfile();
 }
 
@@ -274,7 +334,7 @@ void
 readcmdfile(const_cstring_t name)
 {
 	setinputfile(name, 1);
-	cmdloop(0);
+	cmdloop(0, NULL);
 	popfile();
 }
 
@@ -310,11 +370,238 @@ find_dot_file(cstring_t basename)
 	return basename;
 }
 
+/*
+ * Find a usable cache entry for the file described by statb, moving it to
+ * the front of the cache.
+ */
+
+static struct dotcache*
+dotlookup(const struct stat* statb)
+{
+	struct dotcache* dc;
+	struct dotcache** dcp;
+	for (dcp = &dotcache ; (dc = *dcp) != NULL ; dcp = &dc->next)
+	{
+		if (dc->dev == statb->st_dev && dc->ino == statb->st_ino)
+		{
+			if (dc->size != statb->st_size ||
+					dc->mtime != statb->st_mtime ||
+					dc->aliasgen != aliasgen)
+				return NULL;
+			*dcp = dc->next;
+			dc->next = dotcache;
+			dotcache = dc;
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+
+static void
+dotrecord(struct dotcache* dc, union node* n)
+{
+	struct funcdef* fn;
+	if (dc->complete < 0)
+		return;
+	INTOFF;
+	if (dc->ncmds == dc->maxcmds)
+	{
+		dc->maxcmds = dc->maxcmds == 0 ? 16 : dc->maxcmds * 2;
+		if (dc->cmds == NULL)
+		{
+			dc->cmds = ckmalloctag(dc->maxcmds * sizeof(dc->cmds[0]),
+								   MT_DOTCACHE);
+			dc->ends = ckmalloctag(dc->maxcmds * sizeof(dc->ends[0]),
+								   MT_DOTCACHE);
+		}
+		else
+		{
+			dc->cmds = ckrealloc(dc->cmds,
+								 dc->maxcmds * sizeof(dc->cmds[0]));
+			dc->ends = ckrealloc(dc->ends,
+								 dc->maxcmds * sizeof(dc->ends[0]));
+		}
+	}
+	if (getinputpos(&dc->ends[dc->ncmds]) != 0)
+	{
+		/* a changed alias could not be handled on replay */
+		dc->complete = -1;
+		INTON;
+		return;
+	}
+	fn = copyfunc(n);
+	cksettag(fn, MT_DOTCACHE);
+	dc->cmds[dc->ncmds++] = fn;
+	INTON;
+}
+
+
+/*
+ * Enter a freshly recorded file into the cache, unless it changed while
+ * it was being read or was not read completely.
+ */
+
+static void
+dotstore(struct dotcache* dc, const_cstring_t fullname)
+{
+	struct stat statb;
+	struct dotcache* odc;
+	struct dotcache** dcp;
+	if (dc->complete != 1 || dc->aliasgen != aliasgen ||
+			stat(fullname, &statb) != 0 || statb.st_dev != dc->dev ||
+			statb.st_ino != dc->ino || statb.st_size != dc->size ||
+			statb.st_mtime != dc->mtime || dc->mtime >= time(NULL) - 1)
+	{
+		dotunref(dc);
+		return;
+	}
+	INTOFF;
+	for (dcp = &dotcache ; (odc = *dcp) != NULL ;)
+	{
+		if ((odc->dev == dc->dev && odc->ino == dc->ino) ||
+				(odc->next == NULL && ndotcache >= DOTCACHESIZE))
+		{
+			*dcp = odc->next;
+			ndotcache--;
+			dotunref(odc);
+		}
+		else
+			dcp = &odc->next;
+	}
+	dc->next = dotcache;
+	dotcache = dc;
+	ndotcache++;
+	INTON;
+}
+
+
+/*
+ * Allocate a cache entry for the file described by statb.
+ */
+
+static struct dotcache*
+dotnew(const struct stat* statb)
+{
+	struct dotcache* dc;
+	dc = ckmalloctag(sizeof(*dc), MT_DOTCACHE);
+	memset(dc, 0, sizeof(*dc));
+	dc->dev = statb->st_dev;
+	dc->ino = statb->st_ino;
+	dc->size = statb->st_size;
+	dc->mtime = statb->st_mtime;
+	dc->aliasgen = aliasgen;
+	dc->refcount = 1;
+	return dc;
+}
+
+
+/*
+ * Make a cache entry from the precompiled image of a file, if it has a
+ * usable one.
+ */
+
+static struct dotcache*
+dotimage(const_cstring_t fullname, const struct stat* statb)
+{
+	struct dotcache* dc;
+	struct funcdef** cmds;
+	struct inputpos* ends;
+	int32_t ncmds;
+	if ((cmds = loadimage(fullname, statb, &ncmds, &ends)) == NULL)
+		return NULL;
+	INTOFF;
+	dc = dotnew(statb);
+	dc->cmds = cmds;
+	dc->ends = ends;
+	dc->ncmds = dc->maxcmds = ncmds;
+	dc->complete = 1;
+	INTON;
+	return dc;
+}
+
+
+/*
+ * Evaluate the commands of a cached file, like cmdloop(0) would.  If a
+ * command changes an alias, the rest of the file is read from fullname.
+ * This consumes one reference to the entry.
+ */
+
+static void
+dotreplay(struct dotcache* dc, const_cstring_t fullname)
+{
+	struct jmploc jmploc;
+	struct jmploc* savehandler;
+	struct stackmark smark;
+	uint32_t gen;
+	int32_t i;
+	gen = aliasgen;
+	savehandler = handler;
+	if (setjmp(jmploc.loc))
+	{
+		handler = savehandler;
+		dotunref(dc);
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
+	setstackmark(&smark);
+	for (i = 0 ; i < dc->ncmds ; i++)
+	{
+		if (pendingsig)
+			dotrap();
+		if (nflag == 0)
+		{
+			job_warning = (job_warning == 2) ? 1 : 0;
+			evaltree(getfuncnode(dc->cmds[i]), 0);
+		}
+		popstackmark(&smark);
+		setstackmark(&smark);
+		if (evalskip != 0)
+		{
+			if (evalskip == SKIPRETURN)
+				evalskip = 0;
+			break;
+		}
+		if (aliasgen != gen && i + 1 < dc->ncmds)
+		{
+			setinputfile(fullname, 1);
+			setinputpos(&dc->ends[i]);
+			cmdloop(0, NULL);
+			popfile();
+			break;
+		}
+	}
+	popstackmark(&smark);
+	handler = savehandler;
+	dotunref(dc);
+}
+
+
+static void
+dotunref(struct dotcache* dc)
+{
+	int32_t i;
+	if (--dc->refcount > 0)
+		return;
+	INTOFF;
+	for (i = 0 ; i < dc->ncmds ; i++)
+		unreffunc(dc->cmds[i]);
+	ckfree(dc->cmds);
+	ckfree(dc->ends);
+	ckfree(dc);
+	INTON;
+}
+
+
 int32_t
 dotcmd(int32_t argc, cstring_t* argv)
 {
+	struct jmploc jmploc;
+	struct jmploc* savehandler;
 	cstring_t filename;
-	cstring_t fullname;
+	cstring_t volatile fullname;
+	struct stat statb;
+	struct dotcache* volatile dc;
 
 	if (argc < 2)
 		sherror("missing filename");
@@ -325,10 +612,43 @@ dotcmd(int32_t argc, cstring_t* argv)
 	 */
 	filename = argc > 2 && strcmp(argv[1], "--") == 0 ? argv[2] : argv[1];
 	fullname = find_dot_file(filename);
+	dc = NULL;
+	/* With -v the input has to be echoed, so it must be read. */
+	if (!vflag && stat(fullname, &statb) == 0 && S_ISREG(statb.st_mode))
+	{
+		if ((dc = dotlookup(&statb)) != NULL)
+			dc->refcount++;
+		else if ((dc = dotimage(fullname, &statb)) != NULL)
+		{
+			dc->refcount++;
+			dotstore(dc, fullname);
+		}
+		if (dc != NULL)
+		{
+			commandname = fullname;
+			dotreplay(dc, fullname);
+			return exitstatus;
+		}
+		INTOFF;
+		dc = dotnew(&statb);
+		INTON;
+	}
+	savehandler = handler;
+	if (setjmp(jmploc.loc))
+	{
+		handler = savehandler;
+		if (dc != NULL)
+			dotunref(dc);
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
 	setinputfile(fullname, 1);
 	commandname = fullname;
-	cmdloop(0);
+	cmdloop(0, dc);
 	popfile();
+	handler = savehandler;
+	if (dc != NULL)
+		dotstore(dc, fullname);
 	return exitstatus;
 }
 
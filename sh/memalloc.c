@@ -33,6 +33,7 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "shell.h"
@@ -41,6 +42,171 @@
 #include "sherror.h"
 #include "mystring.h"
 #include "expand.h"
+#include "show.h"
+#include "options.h"
+#include "builtins.h"
+#ifndef NO_HISTORY
+#include "myhistedit.h"
+#endif
+
+/*
+ * Small blocks handed out by ckmalloc() are carved out of larger slabs and
+ * recycled through per-size-class free lists.  The shell allocates and
+ * frees great numbers of tiny long-lived objects (command table entries,
+ * aliases, variable strings, local variable records) and going to malloc
+ * for each of them is comparatively expensive.  Every block is preceded by
+ * a header holding its usable size so that ckfree() and ckrealloc() can
+ * tell pooled blocks from ones larger than POOLMAXSIZE, which are passed
+ * straight to malloc.  Slabs are never returned to the system.
+ *
+ * The header also records the accounting tag (MT_*) the block is charged
+ * to; the per-tag totals are reported by the memstats builtin.
+ */
+
+#define POOLQUANTUM	16		/* granularity of the size classes */
+#define POOLNCLASS	16		/* number of size classes */
+#define POOLMAXSIZE	(POOLQUANTUM * POOLNCLASS)
+#define POOLSLABSIZE	8192		/* size of a slab obtained from malloc */
+
+#define POOLCLASS(n)	((n) == 0 ? 0 : ((n) - 1) / POOLQUANTUM)
+#define CKHDRSIZE	ALIGN(sizeof(struct ckhdr))
+#define CKHDR(p)	((struct ckhdr*)((cstring_t)(p) - CKHDRSIZE))
+#define CKSIZE(p)	(CKHDR(p)->size)
+
+struct ckhdr
+{
+	size_t size;		/* usable size of the block */
+	int32_t tag;		/* accounting tag */
+};
+
+struct poolfree
+{
+	struct poolfree* next;
+};
+
+static struct poolfree* poolfree[POOLNCLASS];
+
+struct memstat
+{
+	size_t live;		/* bytes currently allocated */
+	size_t peak;		/* high-water mark of live */
+	uint32_t nalloc;	/* number of allocations */
+	uint32_t nfree;		/* number of frees */
+};
+
+static struct memstat memstat[MT_NTAGS];
+
+static const_cstring_t const memtagname[MT_NTAGS] =
+{
+	"other", "stack", "vars", "funcs", "jobs", "aliases", "cmdhash",
+	"dotcache"
+};
+
+#ifdef DEBUG
+struct poolstat
+{
+	uint32_t slabs;		/* slabs allocated for this class */
+	uint32_t inuse;		/* blocks currently handed out */
+	uint32_t maxinuse;	/* high-water mark of inuse */
+};
+
+static struct poolstat poolstat[POOLNCLASS];
+static uint32_t poollarge;	/* blocks passed to malloc */
+#endif
+
+
+static void
+memcount(int32_t tag, size_t size)
+{
+	struct memstat* ms;
+	ms = &memstat[tag];
+	ms->live += size;
+	if (ms->live > ms->peak)
+		ms->peak = ms->live;
+	ms->nalloc++;
+}
+
+
+static void
+memuncount(int32_t tag, size_t size)
+{
+	memstat[tag].live -= size;
+	memstat[tag].nfree++;
+}
+
+
+/*
+ * Cut a new slab into blocks of size class cls and put them on the free
+ * list.  Must be called with interrupts off.
+ */
+
+static void
+poolrefill(int32_t cls)
+{
+	cstring_t slab;
+	size_t blocksize;
+	size_t n;
+	struct poolfree* fp;
+	slab = malloc(POOLSLABSIZE);
+	if (slab == NULL)
+		return;
+	blocksize = CKHDRSIZE + (cls + 1) * POOLQUANTUM;
+	for (n = POOLSLABSIZE / blocksize ; n > 0 ; n--)
+	{
+		fp = (struct poolfree*)(slab + CKHDRSIZE);
+		CKSIZE(fp) = (cls + 1) * POOLQUANTUM;
+		fp->next = poolfree[cls];
+		poolfree[cls] = fp;
+		slab += blocksize;
+	}
+#ifdef DEBUG
+	poolstat[cls].slabs++;
+#endif
+}
+
+
+/*
+ * Allocate a block with a size header and charge it to tag.  Returns NULL
+ * when out of space.  Must be called with interrupts off.
+ */
+
+static pvoid_t
+ckalloc(size_t nbytes, int32_t tag)
+{
+	cstring_t p;
+	struct poolfree* fp;
+	int32_t cls;
+	if (nbytes <= POOLMAXSIZE)
+	{
+		cls = POOLCLASS(nbytes);
+		if (poolfree[cls] == NULL)
+			poolrefill(cls);
+		if ((fp = poolfree[cls]) == NULL)
+			return NULL;
+		poolfree[cls] = fp->next;
+		CKHDR(fp)->tag = tag;
+		memcount(tag, CKSIZE(fp));
+#ifdef DEBUG
+		if (++poolstat[cls].inuse > poolstat[cls].maxinuse)
+			poolstat[cls].maxinuse = poolstat[cls].inuse;
+#endif
+		return fp;
+	}
+	if (nbytes > SIZE_MAX - CKHDRSIZE)
+		return NULL;
+	p = malloc(CKHDRSIZE + nbytes);
+	if (p == NULL)
+		return NULL;
+	p += CKHDRSIZE;
+	CKSIZE(p) = nbytes;
+	CKHDR(p)->tag = tag;
+	memcount(tag, nbytes);
+#ifdef DEBUG
+	poollarge++;
+#endif
+	return p;
+}
+
 
 /*
  * Like malloc, but returns an error when out of space.
@@ -48,10 +214,17 @@
 
 pvoid_t
 ckmalloc(size_t nbytes)
+{
+	return ckmalloctag(nbytes, MT_MISC);
+}
+
+
+pvoid_t
+ckmalloctag(size_t nbytes, int32_t tag)
 {
 	pvoid_t p;
 	INTOFF;
-	p = malloc(nbytes);
+	p = ckalloc(nbytes, tag);
 	INTON;
 	if (p == NULL)
 		sherror("Out of space");
@@ -66,34 +239,126 @@ ckmalloc(size_t nbytes)
 pvoid_t
 ckrealloc(pvoid_t p, int32_t nbytes)
 {
+	size_t size;
+	int32_t tag;
+	cstring_t q;
+	if (p == NULL)
+		return ckmalloc(nbytes);
 	INTOFF;
-	p = realloc(p, nbytes);
+	size = CKSIZE(p);
+	tag = CKHDR(p)->tag;
+	if (size > POOLMAXSIZE && (size_t)nbytes > POOLMAXSIZE)
+	{
+		q = realloc((cstring_t)p - CKHDRSIZE, CKHDRSIZE + nbytes);
+		if (q != NULL)
+		{
+			q += CKHDRSIZE;
+			CKSIZE(q) = nbytes;
+			memstat[tag].live -= size;
+			memstat[tag].nalloc--;
+			memcount(tag, nbytes);
+		}
+	}
+	else if (size <= POOLMAXSIZE && (size_t)nbytes <= size)
+		q = p;
+	else
+	{
+		q = ckalloc(nbytes, tag);
+		if (q != NULL)
+		{
+			memcpy(q, p, size < (size_t)nbytes ? size : (size_t)nbytes);
+			ckfree(p);
+		}
+	}
 	INTON;
-	if (p == NULL)
+	if (q == NULL)
 		sherror("Out of space");
-	return p;
+	return q;
 }
 
 void
 ckfree(pvoid_t p)
 {
+	size_t size;
+	int32_t cls;
+	if (p == NULL)
+		return;
 	INTOFF;
-	free(p);
+	size = CKSIZE(p);
+	memuncount(CKHDR(p)->tag, size);
+	if (size <= POOLMAXSIZE)
+	{
+		cls = POOLCLASS(size);
+		((struct poolfree*)p)->next = poolfree[cls];
+		poolfree[cls] = p;
+#ifdef DEBUG
+		poolstat[cls].inuse--;
+#endif
+	}
+	else
+	{
+		free((cstring_t)p - CKHDRSIZE);
+#ifdef DEBUG
+		poollarge--;
+#endif
+	}
 	INTON;
 }
 
 
+/*
+ * Charge a block obtained from ckmalloc() to another tag, for memory
+ * whose owner is only known after it has been allocated.
+ */
+
+void
+cksettag(pvoid_t p, int32_t tag)
+{
+	struct ckhdr* hp;
+	hp = CKHDR(p);
+	if (hp->tag == tag)
+		return;
+	INTOFF;
+	memstat[hp->tag].live -= hp->size;
+	memstat[hp->tag].nalloc--;
+	hp->tag = tag;
+	memcount(tag, hp->size);
+	INTON;
+}
+
+
+#ifdef DEBUG
+void
+showpool(void)
+{
+	int32_t cls;
+	for (cls = 0 ; cls < POOLNCLASS ; cls++)
+		if (poolstat[cls].slabs != 0)
+			sh_trace("pool %4d: %u slabs, %u in use, %u max\n",
+					 (cls + 1) * POOLQUANTUM, poolstat[cls].slabs,
+					 poolstat[cls].inuse, poolstat[cls].maxinuse);
+	sh_trace("pool large: %u in use\n", poollarge);
+}
+#endif
+
+
 /*
  * Make a copy of a string in safe storage.
  */
 
 cstring_t
 savestr(const_cstring_t s)
+{
+	return savestrtag(s, MT_MISC);
+}
+
+cstring_t
+savestrtag(const_cstring_t s, int32_t tag)
 {
 	cstring_t p;
 	size_t len;
 	len = strlen(s);
-	p = ckmalloc(len + 1);
+	p = ckmalloctag(len + 1, tag);
 	memcpy(p, s, len + 1);
 	return p;
 }
@@ -110,20 +375,131 @@ savestr(const_cstring_t s)
 
 #define MINSIZE 496		/* minimum size of a block. */
 
+/*
+ * Blocks released by popstackmark() are kept on a small cache instead of
+ * being freed, because the command loop and evaltree() pop and re-set
+ * their marks after every command and would otherwise malloc and free
+ * the same blocks over and over.  Only blocks up to STACKCACHESIZE bytes
+ * are retained; an idle interactive shell trims the cache down to
+ * STACKCACHEIDLE blocks (see stacktrim()).
+ *
+ * Blocks of STACKMAPSIZE bytes or more are obtained with mmap where the
+ * system has mremap, so that growstackblock() can enlarge a huge string
+ * (say the output of a command substitution) without copying it.
+ */
+
+#define STACKCACHEMAX	8		/* maximum number of cached blocks */
+#define STACKCACHESIZE	65536		/* largest block worth caching */
+#define STACKCACHEIDLE	2		/* blocks kept by stacktrim() */
+#define STACKMAPSIZE	(1024 * 1024)	/* blocks mapped instead of malloced */
+
 
 struct stack_block
 {
 	struct stack_block* prev;
+	int32_t size;		/* total size including this header */
+	boolean_t mapped;	/* obtained with mmap */
 	/* Data follows */
 };
 #define SPACE(sp)	((cstring_t)(sp) + ALIGN(sizeof(struct stack_block)))
 
 static struct stack_block* stackp;
+static struct stack_block* stackcache;	/* released blocks, linked by prev */
+static int32_t nstackcache;
 cstring_t stacknxt;
 int32_t stacknleft;
 cstring_t sstrend;
 
 
+/*
+ * Get a block of at least allocsize bytes, preferably from the cache.
+ * Must be called with interrupts off.
+ */
+
+static struct stack_block*
+stgetblock(int32_t allocsize)
+{
+	struct stack_block* sp;
+	struct stack_block** spp;
+	for (spp = &stackcache ; (sp = *spp) != NULL ; spp = &sp->prev)
+	{
+		if (sp->size >= allocsize)
+		{
+			*spp = sp->prev;
+			nstackcache--;
+			return sp;
+		}
+	}
+#ifdef MREMAP_MAYMOVE
+	if (allocsize >= STACKMAPSIZE)
+	{
+		sp = mmap(NULL, allocsize, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (sp == MAP_FAILED)
+			sherror("Out of space");
+		sp->mapped = 1;
+		sp->size = allocsize;
+		memcount(MT_STACK, allocsize);
+		return sp;
+	}
+#endif
+	sp = ckmalloctag(allocsize, MT_STACK);
+	sp->mapped = 0;
+	sp->size = allocsize;
+	return sp;
+}
+
+
+static void
+stfreeblock(struct stack_block* sp)
+{
+#ifdef MREMAP_MAYMOVE
+	if (sp->mapped)
+	{
+		memuncount(MT_STACK, sp->size);
+		munmap(sp, sp->size);
+		return;
+	}
+#endif
+	ckfree(sp);
+}
+
+
+/*
+ * Resize the block on top of the stack, keeping its contents.  Must be
+ * called with interrupts off and with the block unlinked from the stack.
+ */
+
+static struct stack_block*
+stresizeblock(struct stack_block* sp, int32_t newlen)
+{
+#ifdef MREMAP_MAYMOVE
+	struct stack_block* nsp;
+	if (sp->mapped)
+	{
+		nsp = mremap(sp, sp->size, newlen, MREMAP_MAYMOVE);
+		if (nsp == MAP_FAILED)
+			sherror("Out of space");
+		memstat[MT_STACK].live -= nsp->size;
+		memstat[MT_STACK].nalloc--;
+		memcount(MT_STACK, newlen);
+		nsp->size = newlen;
+		return nsp;
+	}
+	if (newlen >= STACKMAPSIZE)
+	{
+		nsp = stgetblock(newlen);
+		memcpy(SPACE(nsp), SPACE(sp), sp->size - (SPACE(sp) - (cstring_t)sp));
+		ckfree(sp);
+		return nsp;
+	}
+#endif
+	sp = ckrealloc((pvoid_t)sp, newlen);
+	sp->size = newlen;
+	return sp;
+}
+
+
 static void
 stnewblock(int32_t nbytes)
 {
@@ -133,10 +509,10 @@ stnewblock(int32_t nbytes)
 		nbytes = MINSIZE;
 	allocsize = ALIGN(sizeof(struct stack_block)) + ALIGN(nbytes);
 	INTOFF;
-	sp = ckmalloc(allocsize);
+	sp = stgetblock(allocsize);
 	sp->prev = stackp;
 	stacknxt = SPACE(sp);
-	stacknleft = allocsize - (stacknxt - (cstring_t)sp);
+	stacknleft = sp->size - (stacknxt - (cstring_t)sp);
 	sstrend = stacknxt + stacknleft;
 	stackp = sp;
 	INTON;
@@ -192,7 +568,14 @@ popstackmark(struct stackmark* mark)
 	{
 		sp = stackp;
 		stackp = sp->prev;
-		ckfree(sp);
+		if (nstackcache < STACKCACHEMAX && sp->size <= STACKCACHESIZE)
+		{
+			sp->prev = stackcache;
+			stackcache = sp;
+			nstackcache++;
+		}
+		else
+			stfreeblock(sp);
 	}
 	stacknxt = mark->stacknxt;
 	stacknleft = mark->stacknleft;
@@ -201,6 +584,32 @@ popstackmark(struct stackmark* mark)
 }
 
 
+/*
+ * Give cached stack blocks back, keeping the STACKCACHEIDLE most
+ * recently released ones.  Called when an interactive shell is about
+ * to wait for input.
+ */
+
+void
+stacktrim(void)
+{
+	struct stack_block* sp;
+	struct stack_block** spp;
+	int32_t n;
+	INTOFF;
+	spp = &stackcache;
+	for (n = 0 ; n < STACKCACHEIDLE && *spp != NULL ; n++)
+		spp = &(*spp)->prev;
+	while ((sp = *spp) != NULL)
+	{
+		*spp = sp->prev;
+		nstackcache--;
+		stfreeblock(sp);
+	}
+	INTON;
+}
+
+
 /*
  * When the parser reads in a string, it wants to stick the string on the
  * stack and only adjust the stack pvoid_t when it knows how big the
@@ -237,7 +646,7 @@ growstackblock(int32_t min)
 		INTOFF;
 		oldstackp = stackp;
 		stackp = oldstackp->prev;
-		sp = ckrealloc((pvoid_t)oldstackp, newlen);
+		sp = stresizeblock(oldstackp, newlen);
 		sp->prev = stackp;
 		stackp = sp;
 		stacknxt = SPACE(sp);
@@ -317,3 +726,56 @@ stputs(const_cstring_t data, cstring_t p)
 {
 	return (stputbin(data, strlen(data), p));
 }
+
+
+
+/*
+ * The memstats builtin: report memory use per subsystem.
+ */
+
+int32_t
+memstatscmd(int32_t argc __unused, cstring_t* argv __unused)
+{
+	struct memstat* ms;
+	struct memstat total;
+	int32_t reset;
+	int32_t tag;
+	size_t nhist;
+	size_t histbytes;
+	(void)argc; (void)argv;
+
+	reset = 0;
+	while (nextopt("r") != '\0')
+		reset = 1;
+	memset(&total, 0, sizeof(total));
+	out1fmt("%-10s %12s %12s %10s %10s\n", "tag", "live", "peak",
+			"allocs", "frees");
+	for (tag = 0 ; tag < MT_NTAGS ; tag++)
+	{
+		ms = &memstat[tag];
+		out1fmt("%-10s %12lu %12lu %10lu %10lu\n", memtagname[tag],
+				(unsigned long)ms->live, (unsigned long)ms->peak,
+				(unsigned long)ms->nalloc, (unsigned long)ms->nfree);
+		total.live += ms->live;
+		total.peak += ms->peak;
+		total.nalloc += ms->nalloc;
+		total.nfree += ms->nfree;
+		if (reset)
+		{
+			ms->peak = ms->live;
+			ms->nalloc = ms->nfree = 0;
+		}
+	}
+#ifndef NO_HISTORY
+	histmemstats(&nhist, &histbytes);
+#else
+	nhist = histbytes = 0;
+#endif
+	out1fmt("%-10s %12lu %12s %10lu %10s\n", "history",
+			(unsigned long)histbytes, "-", (unsigned long)nhist, "-");
+	out1fmt("%-10s %12lu %12lu %10lu %10lu\n", "total",
+			(unsigned long)(total.live + histbytes),
+			(unsigned long)total.peak, (unsigned long)total.nalloc,
+			(unsigned long)total.nfree);
+	return 0;
+}
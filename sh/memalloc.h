@@ -43,22 +43,43 @@ struct stackmark
 };
 
 
+/*
+ * Tags used to charge ckmalloc() blocks to a subsystem for the memstats
+ * builtin.  Keep memtagname[] in memalloc.c in sync.
+ */
+#define MT_MISC		0	/* anything not listed below */
+#define MT_STACK	1	/* stack blocks */
+#define MT_VAR		2	/* variables and local variable records */
+#define MT_FUNC		3	/* function definitions */
+#define MT_JOB		4	/* job table */
+#define MT_ALIAS	5	/* aliases */
+#define MT_CMDHASH	6	/* command hash table */
+#define MT_DOTCACHE	7	/* parsed files kept by the . builtin */
+#define MT_NTAGS	8
+
 extern cstring_t stacknxt;
 extern int32_t stacknleft;
 extern cstring_t sstrend;
 
 pvoid_t ckmalloc(size_t);
+pvoid_t ckmalloctag(size_t, int32_t);
 pvoid_t ckrealloc(pvoid_t, int32_t);
 void ckfree(pvoid_t);
+void cksettag(pvoid_t, int32_t);
 cstring_t savestr(const_cstring_t);
+cstring_t savestrtag(const_cstring_t, int32_t);
 pvoid_t stalloc(size_t nbytes);
 void stunalloc(pvoid_t);
 void setstackmark(struct stackmark*);
 void popstackmark(struct stackmark*);
+void stacktrim(void);
 cstring_t growstackstr(void);
 cstring_t makestrspace(size_t, cstring_t);
 cstring_t stputbin(const_cstring_t data, size_t len, cstring_t p);
 cstring_t stputs(const_cstring_t data, cstring_t p);
+#ifdef DEBUG
+void showpool(void);
+#endif
 
 
 
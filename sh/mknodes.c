@@ -89,6 +89,7 @@ static void parsefield(void);
 static void output(cstring_t);
 static void outsizes(FILE*);
 static void outfunc(FILE*, int32_t);
+static void outreloc(FILE*);
 static void indent(int32_t, FILE*);
 static int32_t nextfield(cstring_t);
 static void skipbl(void);
@@ -262,6 +263,9 @@ output(cstring_t file)
 	fputs("union node *getfuncnode(struct funcdef *);\n", hfile);
 	fputs("void reffunc(struct funcdef *);\n", hfile);
 	fputs("void unreffunc(struct funcdef *);\n", hfile);
+	fputs("size_t funcsize(struct funcdef *);\n", hfile);
+	fputs("struct funcdef *relocfunc(void *, size_t, const void *);\n", hfile);
+	fputs("int treesize(union node *, size_t *);\n", hfile);
 	fputs(writer, cfile);
 	while (fgets(line, sizeof line, patfile) != NULL)
 	{
@@ -272,6 +276,8 @@ output(cstring_t file)
 			outfunc(cfile, 1);
 		else if (strcmp(p, "%COPY\n") == 0)
 			outfunc(cfile, 0);
+		else if (strcmp(p, "%RELOC\n") == 0)
+			outreloc(cfile);
 		else
 			fputs(line, cfile);
 	}
@@ -304,7 +310,10 @@ outfunc(FILE* cfile, int32_t calcsize)
 	else
 		fputs("	    return NULL;\n", cfile);
 	if (calcsize)
+	{
 		fputs("      funcblocksize += nodesize[n->type];\n", cfile);
+		fputs("      funcnodes++;\n", cfile);
+	}
 	else
 	{
 		fputs("      new = funcblock;\n", cfile);
@@ -374,6 +383,14 @@ outfunc(FILE* cfile, int32_t calcsize)
 								sp->tag, fp->name, sp->tag, fp->name);
 					}
 					break;
+				case T_TEMP:
+					if (! calcsize)
+					{
+						indent(12, cfile);
+						fprintf(cfile, "memset(&new->%s.%s, 0, sizeof(new->%s.%s));\n",
+								sp->tag, fp->name, sp->tag, fp->name);
+					}
+					break;
 			}
 		}
 		indent(12, cfile);
@@ -385,6 +402,69 @@ outfunc(FILE* cfile, int32_t calcsize)
 }
 
 
+/*
+ * Output the body of relocnode(), which adjusts the pointers of a node
+ * read back from an image and recurses into its children.
+ */
+
+static void
+outreloc(FILE* cfile)
+{
+	struct str* sp;
+	struct field* fp;
+	int32_t i;
+	fputs("      if (n == NULL || relocbad)\n", cfile);
+	fputs("	    return;\n", cfile);
+	fprintf(cfile, "      if (n->type < 0 || n->type >= %d ||\n", ntypes);
+	fputs("	  (char *)n + nodesize[n->type] > relocend) {\n", cfile);
+	fputs("	    relocbad = 1;\n", cfile);
+	fputs("	    return;\n", cfile);
+	fputs("      }\n", cfile);
+	fputs("      switch (n->type) {\n", cfile);
+	for (sp = str ; sp < &str[nstr] ; sp++)
+	{
+		for (i = 0 ; i < ntypes ; i++)
+		{
+			if (nodestr[i] == sp)
+				fprintf(cfile, "      case %s:\n", nodename[i]);
+		}
+		for (i = sp->nfields ; --i >= 1 ;)
+		{
+			fp = &sp->field[i];
+			switch (fp->type)
+			{
+				case T_NODE:
+					indent(12, cfile);
+					fprintf(cfile, "n->%s.%s = relocptr(n->%s.%s, n, sizeof(int));\n",
+							sp->tag, fp->name, sp->tag, fp->name);
+					indent(12, cfile);
+					fprintf(cfile, "relocnode(n->%s.%s);\n",
+							sp->tag, fp->name);
+					break;
+				case T_NODELIST:
+					indent(12, cfile);
+					fprintf(cfile, "n->%s.%s = relocnodelist(n->%s.%s, n);\n",
+							sp->tag, fp->name, sp->tag, fp->name);
+					break;
+				case T_STRING:
+					indent(12, cfile);
+					fprintf(cfile, "n->%s.%s = relocstr(n->%s.%s, n);\n",
+							sp->tag, fp->name, sp->tag, fp->name);
+					break;
+				case T_TEMP:
+					indent(12, cfile);
+					fprintf(cfile, "memset(&n->%s.%s, 0, sizeof(n->%s.%s));\n",
+							sp->tag, fp->name, sp->tag, fp->name);
+					break;
+			}
+		}
+		indent(12, cfile);
+		fputs("break;\n", cfile);
+	}
+	fputs("      };\n", cfile);
+}
+
+
 static void
 indent(int32_t amount, FILE* fp)
 {
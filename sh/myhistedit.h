@@ -39,4 +39,5 @@ extern int32_t displayhist;
 void histedit(void);
 void sethistsize(const_cstring_t);
 void setterm(const_cstring_t);
+void histmemstats(size_t*, size_t*);
 
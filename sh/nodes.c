@@ -40,6 +40,7 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include "shell.h"
 #include "nodes.h"
 #include "memalloc.h"
@@ -50,9 +51,13 @@
  */
 
 static size_t  funcblocksize;	/* size of structures in function */
+static int32_t funcnodes;		/* number of nodes in function */
 static size_t  funcstringsize;	/* size of strings in node */
 static pvoid_t funcblock;   	/* block to allocate function from */
 static cstring_t   funcstring;  	/* block to allocate strings from */
+static cstring_t   relocend;		/* end of block being relocated */
+static intptr_t    relocdelta;		/* new address minus old address */
+static int32_t     relocbad;		/* block being relocated is inconsistent */
 
 static const int16_t nodesize[27] =
 {
@@ -91,11 +96,15 @@ static void sizenodelist(struct nodelist*);
 static union node* copynode(union node*);
 static struct nodelist* copynodelist(struct nodelist*);
 static cstring_t nodesavestr(const_cstring_t);
+static void relocnode(union node*);
+static struct nodelist* relocnodelist(struct nodelist*, const void*);
+static cstring_t relocstr(cstring_t, const void*);
 
 
 struct funcdef
 {
 	uint32_t refcount;
+	size_t size;		/* size of the whole block */
 	union node n;
 };
 
@@ -112,8 +121,9 @@ copyfunc(union node* n)
 	funcblocksize = offsetof(struct funcdef, n);
 	funcstringsize = 0;
 	calcsize(n);
-	fn = ckmalloc(funcblocksize + funcstringsize);
+	fn = ckmalloctag(funcblocksize + funcstringsize, MT_FUNC);
 	fn->refcount = 1;
+	fn->size = funcblocksize + funcstringsize;
 	funcblock = (cstring_t)fn + offsetof(struct funcdef, n);
 	funcstring = (cstring_t)fn + funcblocksize;
 	copynode(n);
@@ -121,6 +131,24 @@ copyfunc(union node* n)
 }
 
 
+/*
+ * Return the number of nodes in a parse tree, and set *sizep to the size
+ * a copy of it would take.
+ */
+
+int32_t
+treesize(union node* n, size_t* sizep)
+{
+	funcblocksize = 0;
+	funcstringsize = 0;
+	funcnodes = 0;
+	calcsize(n);
+	if (sizep != NULL)
+		*sizep = funcblocksize + funcstringsize;
+	return funcnodes;
+}
+
+
 union node*
 		getfuncnode(struct funcdef* fn)
 {
@@ -134,6 +162,7 @@ calcsize(union node* n)
 	if (n == NULL)
 		return;
 	funcblocksize += nodesize[n->type];
+	funcnodes++;
 	switch (n->type)
 	{
 		case NSEMI:
@@ -241,6 +270,8 @@ static union node*
 			new->nbinary.ch1 = copynode(n->nbinary.ch1);
 			break;
 		case NCMD:
+			memset(&new->ncmd.cmdcache, 0, sizeof(new->ncmd.cmdcache));
+			memset(&new->ncmd.cmdgen, 0, sizeof(new->ncmd.cmdgen));
 			new->ncmd.redirect = copynode(n->ncmd.redirect);
 			new->ncmd.args = copynode(n->ncmd.args);
 			break;
@@ -276,6 +307,7 @@ static union node*
 			break;
 		case NDEFUN:
 		case NARG:
+			new->narg.literal = n->narg.literal;
 			new->narg.backquote = copynodelist(n->narg.backquote);
 			new->narg.text = nodesavestr(n->narg.text);
 			new->narg.next = copynode(n->narg.next);
@@ -285,6 +317,7 @@ static union node*
 		case NFROMTO:
 		case NAPPEND:
 		case NCLOBBER:
+			memset(&new->nfile.expfname, 0, sizeof(new->nfile.expfname));
 			new->nfile.fname = copynode(n->nfile.fname);
 			new->nfile.next = copynode(n->nfile.next);
 			new->nfile.fd = n->nfile.fd;
@@ -344,6 +377,201 @@ nodesavestr(const_cstring_t s)
 }
 
 
+/*
+ * A function definition is a single block without outside references,
+ * which can be written to a file as it is (see image.c).  To use such a
+ * block again, relocfunc() moves every pointer in it by the distance
+ * between the old and the new address of the block.  Since copynode()
+ * places children after their parents, every pointer must point into the
+ * block and past the object containing it; a block that violates this is
+ * rejected, so a damaged image can neither make the shell loop nor make
+ * it reference memory outside the block.
+ */
+
+size_t
+funcsize(struct funcdef* fn)
+{
+	return fn->size;
+}
+
+
+struct funcdef*
+relocfunc(pvoid_t block, size_t size, const void* oldaddr)
+{
+	struct funcdef* fn;
+	if (size < offsetof(struct funcdef, n) + sizeof(int32_t))
+		return NULL;
+	fn = block;
+	relocend = (cstring_t)block + size;
+	relocdelta = (intptr_t)block - (intptr_t)oldaddr;
+	relocbad = 0;
+	relocnode(&fn->n);
+	if (relocbad)
+		return NULL;
+	fn->refcount = 1;
+	fn->size = size;
+	return fn;
+}
+
+
+static pvoid_t
+relocptr(pvoid_t p, const void* from, size_t size)
+{
+	cstring_t q;
+	if (p == NULL)
+		return NULL;
+	q = (cstring_t)((intptr_t)p + relocdelta);
+	if (q <= (const_cstring_t)from || q > relocend - size ||
+			(size > 1 && ((intptr_t)q & (sizeof(pvoid_t) - 1)) != 0))
+	{
+		relocbad = 1;
+		return NULL;
+	}
+	return q;
+}
+
+
+static void
+relocnode(union node* n)
+{
+	if (n == NULL || relocbad)
+		return;
+	if (n->type < 0 || n->type >= 27 ||
+			(cstring_t)n + nodesize[n->type] > relocend)
+	{
+		relocbad = 1;
+		return;
+	}
+	switch (n->type)
+	{
+		case NSEMI:
+		case NAND:
+		case NOR:
+		case NWHILE:
+		case NUNTIL:
+			n->nbinary.ch2 = relocptr(n->nbinary.ch2, n, sizeof(int32_t));
+			relocnode(n->nbinary.ch2);
+			n->nbinary.ch1 = relocptr(n->nbinary.ch1, n, sizeof(int32_t));
+			relocnode(n->nbinary.ch1);
+			break;
+		case NCMD:
+			memset(&n->ncmd.cmdcache, 0, sizeof(n->ncmd.cmdcache));
+			memset(&n->ncmd.cmdgen, 0, sizeof(n->ncmd.cmdgen));
+			n->ncmd.redirect = relocptr(n->ncmd.redirect, n, sizeof(int32_t));
+			relocnode(n->ncmd.redirect);
+			n->ncmd.args = relocptr(n->ncmd.args, n, sizeof(int32_t));
+			relocnode(n->ncmd.args);
+			break;
+		case NPIPE:
+			n->npipe.cmdlist = relocnodelist(n->npipe.cmdlist, n);
+			break;
+		case NREDIR:
+		case NBACKGND:
+		case NSUBSHELL:
+			n->nredir.redirect = relocptr(n->nredir.redirect, n, sizeof(int32_t));
+			relocnode(n->nredir.redirect);
+			n->nredir.n = relocptr(n->nredir.n, n, sizeof(int32_t));
+			relocnode(n->nredir.n);
+			break;
+		case NIF:
+			n->nif.elsepart = relocptr(n->nif.elsepart, n, sizeof(int32_t));
+			relocnode(n->nif.elsepart);
+			n->nif.ifpart = relocptr(n->nif.ifpart, n, sizeof(int32_t));
+			relocnode(n->nif.ifpart);
+			n->nif.test = relocptr(n->nif.test, n, sizeof(int32_t));
+			relocnode(n->nif.test);
+			break;
+		case NFOR:
+			n->nfor.var = relocstr(n->nfor.var, n);
+			n->nfor.body = relocptr(n->nfor.body, n, sizeof(int32_t));
+			relocnode(n->nfor.body);
+			n->nfor.args = relocptr(n->nfor.args, n, sizeof(int32_t));
+			relocnode(n->nfor.args);
+			break;
+		case NCASE:
+			n->ncase.cases = relocptr(n->ncase.cases, n, sizeof(int32_t));
+			relocnode(n->ncase.cases);
+			n->ncase.expr = relocptr(n->ncase.expr, n, sizeof(int32_t));
+			relocnode(n->ncase.expr);
+			break;
+		case NCLIST:
+		case NCLISTFALLTHRU:
+			n->nclist.body = relocptr(n->nclist.body, n, sizeof(int32_t));
+			relocnode(n->nclist.body);
+			n->nclist.pattern = relocptr(n->nclist.pattern, n, sizeof(int32_t));
+			relocnode(n->nclist.pattern);
+			n->nclist.next = relocptr(n->nclist.next, n, sizeof(int32_t));
+			relocnode(n->nclist.next);
+			break;
+		case NDEFUN:
+		case NARG:
+			n->narg.backquote = relocnodelist(n->narg.backquote, n);
+			n->narg.text = relocstr(n->narg.text, n);
+			n->narg.next = relocptr(n->narg.next, n, sizeof(int32_t));
+			relocnode(n->narg.next);
+			break;
+		case NTO:
+		case NFROM:
+		case NFROMTO:
+		case NAPPEND:
+		case NCLOBBER:
+			memset(&n->nfile.expfname, 0, sizeof(n->nfile.expfname));
+			n->nfile.fname = relocptr(n->nfile.fname, n, sizeof(int32_t));
+			relocnode(n->nfile.fname);
+			n->nfile.next = relocptr(n->nfile.next, n, sizeof(int32_t));
+			relocnode(n->nfile.next);
+			break;
+		case NTOFD:
+		case NFROMFD:
+			n->ndup.vname = relocptr(n->ndup.vname, n, sizeof(int32_t));
+			relocnode(n->ndup.vname);
+			n->ndup.next = relocptr(n->ndup.next, n, sizeof(int32_t));
+			relocnode(n->ndup.next);
+			break;
+		case NHERE:
+		case NXHERE:
+			n->nhere.doc = relocptr(n->nhere.doc, n, sizeof(int32_t));
+			relocnode(n->nhere.doc);
+			n->nhere.next = relocptr(n->nhere.next, n, sizeof(int32_t));
+			relocnode(n->nhere.next);
+			break;
+		case NNOT:
+			n->nnot.com = relocptr(n->nnot.com, n, sizeof(int32_t));
+			relocnode(n->nnot.com);
+			break;
+	};
+}
+
+
+static struct nodelist*
+relocnodelist(struct nodelist* lp, const void* from)
+{
+	struct nodelist* start;
+	start = lp = relocptr(lp, from, sizeof(struct nodelist));
+	while (lp != NULL && !relocbad)
+	{
+		lp->n = relocptr(lp->n, lp, sizeof(int32_t));
+		relocnode(lp->n);
+		lp->next = relocptr(lp->next, lp, sizeof(struct nodelist));
+		lp = lp->next;
+	}
+	return start;
+}
+
+
+static cstring_t
+relocstr(cstring_t s, const void* from)
+{
+	s = relocptr(s, from, 1);
+	if (s != NULL && memchr(s, '\0', relocend - s) == NULL)
+	{
+		relocbad = 1;
+		return NULL;
+	}
+	return s;
+}
+
+
 void
 reffunc(struct funcdef* fn)
 {
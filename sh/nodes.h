@@ -45,6 +45,8 @@ struct ncmd
 	int32_t type;
 	union node* args;
 	union node* redirect;
+	uint32_t cmdgen;
+	struct tblentry* cmdcache;
 };
 
 
@@ -105,6 +107,7 @@ struct narg
 	union node* next;
 	cstring_t text;
 	struct nodelist* backquote;
+	int32_t literal;
 };
 
 
@@ -134,7 +137,6 @@ struct nhere
 	int32_t fd;
 	union node* next;
 	union node* doc;
-	cstring_t expdoc;
 };
 
 
@@ -176,3 +178,6 @@ struct funcdef* copyfunc(union node*);
 union node* getfuncnode(struct funcdef*);
 void reffunc(struct funcdef*);
 void unreffunc(struct funcdef*);
+size_t funcsize(struct funcdef*);
+struct funcdef* relocfunc(pvoid_t, size_t, const void*);
+int32_t treesize(union node*, size_t*);
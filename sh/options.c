@@ -284,7 +284,11 @@ minus_o(cstring_t name, int32_t val)
 		for (i = 0; i < NOPTS; i++)
 			if (equal(name, optlist[i].name))
 			{
-				setoption(optlist[i].letter, val);
+				/* Some options have no letter. */
+				if (optlist[i].letter == '\0')
+					optlist[i].val = val;
+				else
+					setoption(optlist[i].letter, val);
 				return;
 			}
 		sherror("Illegal option -o %s", name);
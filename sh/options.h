@@ -64,8 +64,9 @@ struct shparam
 #define	Tflag optlist[16].val
 #define	Pflag optlist[17].val
 #define	hflag optlist[18].val
+#define	bytecodeflag optlist[19].val
 
-#define NOPTS	19
+#define NOPTS	20
 
 struct optent
 {
@@ -96,6 +97,7 @@ struct optent optlist[NOPTS] =
 	{ "trapsasync",	'T',	0 },
 	{ "physical",	'P',	0 },
 	{ "trackall",	'h',	0 },
+	{ "bytecode",	'\0',	0 },
 };
 #else
 extern struct optent optlist[NOPTS];
@@ -84,10 +84,8 @@ FORCEINLINE void outc(char32_t ch, poutput_t file)
 {
 	if (file->nleft == 0)
 		emptyoutbuf(file);
-#if _UNSURE_IMPLEMENTATION
 	else
 		--(file->nleft);
-#endif
 	*(file->nextc++) = (cchar_t)ch;
 }
 
@@ -33,6 +33,9 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -53,6 +56,7 @@
 #include "show.h"
 #include "eval.h"
 #include "exec.h"	/* to check for special builtins */
+#include "builtins.h"
 #ifndef NO_HISTORY
 #include "myhistedit.h"
 #endif
@@ -81,12 +85,31 @@ struct heredoc
 	int32_t striptabs;		/* if set, strip leading tabs */
 };
 
+/*
+ * Temporary memory of the parser is taken from a bump arena: a list of
+ * chunks, of which only the newest one is allocated from.  Allocations
+ * are released in the reverse order, so only the most recent one can be
+ * resized, and everything is released at once when parsing of a command
+ * starts.  Each allocation is preceded by the offset of the previous one
+ * in the chunk.  One released chunk is kept for the next command.
+ */
+
+#define PTEMPCHUNK	4096	/* default size of a chunk */
+#define PTEMPALIGN(n)	(((n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+#define PTEMPHDR	PTEMPALIGN(sizeof(size_t))
+#define PTEMPNONE	((size_t)-1)
+
 struct parser_temp
 {
-	struct parser_temp* next;
-	pvoid_t data;
+	struct parser_temp* next;	/* older chunk */
+	size_t size;			/* bytes available in the chunk */
+	size_t used;			/* bytes allocated */
+	size_t last;			/* offset of the most recent allocation */
 };
 
+#define PTEMPDATA(t)	((cstring_t)(t) + PTEMPALIGN(sizeof(struct parser_temp)))
+#define PTEMPPREV(t, off)	(*(size_t*)(PTEMPDATA(t) + (off)))
+
 
 static struct heredoc* heredoclist;	/* list of here documents to read */
 static int32_t doprompt;		/* if set, prompt the user */
@@ -102,6 +125,8 @@ static int32_t quoteflag;		/* set if (part of) last token was quoted */
 static int32_t startlinno;		/* line # where last token started */
 static int32_t funclinno;		/* line # where the current function started */
 static struct parser_temp* parser_temp;
+static struct parser_temp* parser_temp_spare;	/* released chunk */
+static uint32_t parsetokens;		/* number of tokens read */
 
 
 static union node* list(int32_t);
@@ -118,24 +143,52 @@ static int32_t readtoken(void);
 static int32_t xxreadtoken(void);
 static int32_t readtoken1(int32_t, const_cstring_t, const_cstring_t, int32_t);
 static int32_t noexpand(cstring_t);
+static int32_t isliteral(const_cstring_t);
 static void consumetoken(int32_t);
 DECLSPEC_NORETURN static void synexpect(int32_t);
 DECLSPEC_NORETURN static void synerror(const_cstring_t);
 static void setprompt(int32_t);
 
 
+static void
+parser_temp_release(struct parser_temp* t)
+{
+	if (parser_temp_spare == NULL && t->size == PTEMPCHUNK)
+		parser_temp_spare = t;
+	else
+		ckfree(t);
+}
+
+
 static pvoid_t
 parser_temp_alloc(size_t len)
 {
 	struct parser_temp* t;
+	size_t need;
 	INTOFF;
-	t = ckmalloc(sizeof(*t));
-	t->data = NULL;
-	t->next = parser_temp;
-	parser_temp = t;
-	t->data = ckmalloc(len);
+	need = PTEMPHDR + PTEMPALIGN(len);
+	t = parser_temp;
+	if (t == NULL || t->size - t->used < need)
+	{
+		if (need <= PTEMPCHUNK && parser_temp_spare != NULL)
+		{
+			t = parser_temp_spare;
+			parser_temp_spare = NULL;
+		}
+		else
+			t = ckmalloc(PTEMPALIGN(sizeof(*t)) +
+						 (need > PTEMPCHUNK ? need : PTEMPCHUNK));
+		t->size = need > PTEMPCHUNK ? need : PTEMPCHUNK;
+		t->used = 0;
+		t->last = PTEMPNONE;
+		t->next = parser_temp;
+		parser_temp = t;
+	}
+	PTEMPPREV(t, t->used) = t->last;
+	t->last = t->used;
+	t->used += need;
 	INTON;
-	return t->data;
+	return PTEMPDATA(t) + t->last + PTEMPHDR;
 }
 
 
@@ -143,13 +196,31 @@ static pvoid_t
 parser_temp_realloc(pvoid_t ptr, size_t len)
 {
 	struct parser_temp* t;
-	INTOFF;
+	cstring_t p;
+	size_t oldlen;
 	t = parser_temp;
-	if (ptr != t->data)
+	if (t == NULL || t->last == PTEMPNONE ||
+			ptr != PTEMPDATA(t) + t->last + PTEMPHDR)
 		sherror("bug: parser_temp_realloc misused");
-	t->data = ckrealloc(t->data, len);
-	INTON;
-	return t->data;
+	if (t->size - t->last >= PTEMPHDR + PTEMPALIGN(len))
+	{
+		t->used = t->last + PTEMPHDR + PTEMPALIGN(len);
+		return ptr;
+	}
+	/* Move it to a new chunk; the old one stays until it is released. */
+	oldlen = t->used - t->last - PTEMPHDR;
+	t->used = t->last;
+	t->last = PTEMPPREV(t, t->last);
+	p = parser_temp_alloc(len);
+	memcpy(p, ptr, oldlen);
+	if (t->used == 0)
+	{
+		INTOFF;
+		parser_temp->next = t->next;
+		parser_temp_release(t);
+		INTON;
+	}
+	return p;
 }
 
 
@@ -157,18 +228,26 @@ static void
 parser_temp_free_upto(pvoid_t ptr)
 {
 	struct parser_temp* t;
-	int32_t done = 0;
 	INTOFF;
-	while (parser_temp != NULL && !done)
+	while ((t = parser_temp) != NULL)
 	{
-		t = parser_temp;
+		if ((cstring_t)ptr > PTEMPDATA(t) &&
+				(cstring_t)ptr < PTEMPDATA(t) + t->used)
+		{
+			t->used = (cstring_t)ptr - PTEMPHDR - PTEMPDATA(t);
+			t->last = PTEMPPREV(t, t->used);
+			if (t->used == 0)
+			{
+				parser_temp = t->next;
+				parser_temp_release(t);
+			}
+			break;
+		}
 		parser_temp = t->next;
-		done = t->data == ptr;
-		ckfree(t->data);
-		ckfree(t);
+		parser_temp_release(t);
 	}
 	INTON;
-	if (!done)
+	if (t == NULL)
 		sherror("bug: parser_temp_free_upto misused");
 }
 
@@ -178,12 +257,10 @@ parser_temp_free_all(void)
 {
 	struct parser_temp* t;
 	INTOFF;
-	while (parser_temp != NULL)
+	while ((t = parser_temp) != NULL)
 	{
-		t = parser_temp;
 		parser_temp = t->next;
-		ckfree(t->data);
-		ckfree(t);
+		parser_temp_release(t);
 	}
 	INTON;
 }
@@ -482,6 +559,7 @@ static union node*
 				n2->type = NARG;
 				n2->narg.text = argvars;
 				n2->narg.backquote = NULL;
+				n2->narg.literal = 0;
 				n2->narg.next = NULL;
 				n1->nfor.args = n2;
 				/*
@@ -682,6 +760,7 @@ static union node*
 	n->type = NCMD;
 	n->ncmd.args = args;
 	n->ncmd.redirect = redir;
+	n->ncmd.cmdgen = 0;
 	return n;
 }
 
@@ -694,6 +773,7 @@ static union node*
 	n->narg.next = NULL;
 	n->narg.text = wordtext;
 	n->narg.backquote = backquotelist;
+	n->narg.literal = isliteral(wordtext);
 	return n;
 }
 
@@ -835,17 +915,13 @@ top:
 	 */
 	if (t == TWORD && !quoteflag)
 	{
-		const_cstring_t const* pp;
-		if (checkkwd & CHKKWD)
-			for (pp = parsekwd; *pp; pp++)
-			{
-				if (**pp == *wordtext && equal(*pp, wordtext))
-				{
-					lasttoken = t = pp - parsekwd + KWDOFFSET;
-					TRACE(("keyword %s recognized\n", tokname[t]));
-					goto out;
-				}
-			}
+		int32_t kwd;
+		if (checkkwd & CHKKWD && (kwd = findkwd(wordtext)) >= 0)
+		{
+			lasttoken = t = kwd;
+			TRACE(("keyword %s recognized\n", tokname[t]));
+			goto out;
+		}
 		if (checkkwd & CHKALIAS &&
 				(ap = lookupalias(wordtext, 1)) != NULL)
 		{
@@ -895,6 +971,7 @@ xxreadtoken(void)
 		tokpushback = 0;
 		return lasttoken;
 	}
+	parsetokens++;
 	if (needprompt)
 	{
 		setprompt(2);
@@ -1965,6 +2042,51 @@ noexpand(cstring_t text)
 }
 
 
+/*
+ * Returns true if the text stands for itself after every expansion: no
+ * quoting, substitutions, pattern characters or tildes.  expandarg() copies
+ * such words without scanning them.
+ */
+
+static int32_t
+isliteral(const_cstring_t text)
+{
+	const_cstring_t p;
+	char c;
+	for (p = text ; (c = *p) != '\0' ; p++)
+	{
+		if (BASESYNTAX[(int32_t)c] == CCTL)
+			return 0;
+		if (c == '*' || c == '?' || c == '[' || c == '~')
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Return the token for a reserved word, or -1 if the argument is not one.
+ * The words are found with the perfect hash table built by mktokens, using
+ * the same hash function as find_builtin().
+ */
+
+int32_t
+findkwd(const_cstring_t s)
+{
+	const_cstring_t p;
+	uint32_t h;
+	int32_t i;
+	h = 0;
+	for (p = s ; *p != '\0' ; p++)
+		h = (h + (unsigned char)*p) * KWDHASHSEED;
+	h *= KWDHASHSEED;
+	if ((i = kwdhash[h >> (32 - KWDHASHBITS)]) < 0 ||
+			*parsekwd[i] != *s || !equal(parsekwd[i], s))
+		return -1;
+	return i + KWDOFFSET;
+}
+
+
 /*
  * Return true if the argument is a legal variable name (a letter or
  * underscore followed by zero or more letters, underscores, and digits).
@@ -2180,6 +2302,7 @@ expandstr(const_cstring_t ps)
 		n.narg.next = NULL;
 		n.narg.text = wordtext;
 		n.narg.backquote = backquotelist;
+		n.narg.literal = 0;
 		expandarg(&n, NULL, 0);
 		result = stackblock();
 		INTOFF;
@@ -2200,3 +2323,98 @@ expandstr(const_cstring_t ps)
 		raise(SIGINT);
 	return result;
 }
+
+
+/*
+ * The parsebench builtin parses files without executing them and reports
+ * the throughput of the parser.  Only the time spent in parsecmd() is
+ * counted.
+ */
+
+int32_t
+parsebenchcmd(int32_t argc __unused, cstring_t* argv __unused)
+{
+	struct jmploc jmploc;
+	struct jmploc* const savehandler = handler;
+	struct stackmark smark;
+	struct timeval tv0;
+	struct timeval tv1;
+	struct stat statb;
+	union node* n;
+	volatile int32_t pushed;
+	uint32_t tokens;
+	double secs;
+	double bytes;
+	size_t treebytes;
+	size_t size;
+	volatile int32_t count;
+	int32_t ncmds;
+	int32_t nodes;
+	int32_t i;
+	(void)argc; (void)argv;
+
+	count = 1;
+	while (nextopt("n:") != '\0')
+		if ((count = number(shoptarg)) <= 0)
+			sherror("invalid count: %s", shoptarg);
+	if (*argptr == NULL)
+		sherror("usage: parsebench [-n count] file ...");
+	pushed = 0;
+	if (setjmp(jmploc.loc))
+	{
+		handler = savehandler;
+		if (pushed)
+			popfile();
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
+	for (; *argptr != NULL ; argptr++)
+	{
+		if (stat(*argptr, &statb) != 0)
+			sherror("%s: %s", *argptr, strerror(errno));
+		secs = 0;
+		tokens = parsetokens;
+		ncmds = nodes = 0;
+		treebytes = 0;
+		for (i = 0 ; i < count ; i++)
+		{
+			setinputfile(*argptr, 1);
+			pushed = 1;
+			setstackmark(&smark);
+			for (;;)
+			{
+				gettimeofday(&tv0, NULL);
+				n = parsecmd(0);
+				gettimeofday(&tv1, NULL);
+				secs += (tv1.tv_sec - tv0.tv_sec) +
+						(tv1.tv_usec - tv0.tv_usec) / 1e6;
+				if (n == NEOF)
+					break;
+				if (n != NULL && i == 0)
+				{
+					ncmds++;
+					nodes += treesize(n, &size);
+					treebytes += size;
+				}
+				popstackmark(&smark);
+				setstackmark(&smark);
+			}
+			popstackmark(&smark);
+			popfile();
+			pushed = 0;
+		}
+		tokens = (parsetokens - tokens) / count;
+		bytes = (double)statb.st_size;
+		out1fmt("%s: %.0f bytes, %u tokens, %d commands, %d nodes "
+				"(%lu bytes)\n", *argptr, bytes, (unsigned)tokens,
+				(int)ncmds, (int)nodes, (unsigned long)treebytes);
+		if (secs <= 0)
+			secs = 1e-6 * count;
+		out1fmt("%s: %.3f ms per pass, %.2f MB/s, %.0f tokens/s, "
+				"%.0f nodes/s\n", *argptr, secs * 1e3 / count,
+				bytes * count / secs / 1e6, (double)tokens * count / secs,
+				(double)nodes * count / secs);
+	}
+	handler = savehandler;
+	return 0;
+}
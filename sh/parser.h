@@ -78,6 +78,7 @@ extern const_cstring_t const parsekwd[];
 union node* parsecmd(int32_t);
 void forcealias(void);
 void fixredir(union node*, const_cstring_t, int32_t);
+int32_t findkwd(const_cstring_t);
 int32_t goodname(const_cstring_t);
 int32_t isassignment(const_cstring_t);
 cstring_t getprompt(pvoid_t);
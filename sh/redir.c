@@ -34,6 +34,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <paths.h>
 #include <signal.h>
 #include <string.h>
 #include <fcntl.h>
@@ -50,6 +53,7 @@
 #include "memalloc.h"
 #include "sherror.h"
 #include "options.h"
+#include "var.h"
 
 /*
  * Code for dealing with input/output redirection.
@@ -76,8 +80,29 @@ static struct redirtab* redirlist;
 */
 static int32_t fd0_redirected = 0;
 
-static void openredirect(union node*, char[10 ]);
+int32_t heredocmode = HEREDOC_PIPE;
+
+/*
+ * Here-documents that are expanded are expanded and written about this
+ * much at a time, so that the shell never holds all of a large document.
+ */
+
+#define HEREPIECE	8192
+
+struct herestream
+{
+	const_cstring_t p;		/* rest of the document */
+	struct nodelist* bq;	/* command substitutions in it */
+	int32_t expand;			/* NXHERE: expand before writing */
+	cstring_t buf;			/* expanded pieces collected for writing */
+	size_t bufsize;
+};
+
+static void openredirect(union node*, char[10 ], int32_t);
+static const_cstring_t herenext(struct herestream*, size_t*);
+static int32_t openherefile(void);
 static int32_t openhere(union node*);
+static void openheres(union node*, int32_t*);
 
 
 /*
@@ -93,15 +118,26 @@ static int32_t openhere(union node*);
  * will still abort blocking opens such as fifos (they will fail
  * with EINTR). There is, however, a race condition if an interrupt
  * arrives after INTOFF and before open blocks.
+ *
+ * Here-documents are expanded and opened by openheres() before any file
+ * descriptor is changed, so that command substitutions in them see the
+ * file descriptors of the shell and can be interrupted.
  */
 
 void
 redirect(union node* redir, int32_t flags)
 {
 	union node* n;
-	struct redirtab* sv = NULL;
+	struct redirtab* volatile sv = NULL;
+	struct jmploc jmploc;
+	struct jmploc* savehandler;
+	int32_t* volatile herefds;
+	volatile int32_t nhere;
+	volatile int32_t saveint;
 	size_t i;
 	int32_t fd;
+	int32_t herefd;
+	int32_t h;
 	char memory[10];	/* file descriptors to write to memory */
 	INTOFF;
 	for (i = 10 ; i-- > 0 ;)
@@ -116,6 +152,42 @@ redirect(union node* redir, int32_t flags)
 		sv->next = redirlist;
 		redirlist = sv;
 	}
+	nhere = 0;
+	herefds = NULL;
+	savehandler = handler;
+	for (n = redir ; n ; n = n->nfile.next)
+		if (n->nfile.type == NHERE || n->nfile.type == NXHERE)
+			nhere++;
+	if (nhere > 0)
+	{
+		herefds = stalloc(nhere * sizeof(*herefds));
+		for (h = 0 ; h < nhere ; h++)
+			herefds[h] = -1;
+		saveint = -1;
+		if (setjmp(jmploc.loc))
+		{
+			handler = savehandler;
+			if (saveint >= 0)
+				SETINTON(saveint + 1);
+			for (h = 0 ; h < nhere ; h++)
+				if (herefds[h] >= 0)
+					close(herefds[h]);
+			longjmp(handler->loc, 1);
+		}
+		handler = &jmploc;
+		/*
+		 * Allow interrupts while the documents are expanded, as
+		 * they would be if the caller expanded them.
+		 */
+		saveint = is_int_on();
+		SETINTON(0);
+		if (int_pending())
+			onint();
+		openheres(redir, herefds);
+		SETINTON(saveint);
+		saveint = -1;
+	}
+	h = 0;
 	for (n = redir ; n ; n = n->nfile.next)
 	{
 		fd = n->nfile.fd;
@@ -143,10 +215,18 @@ redirect(union node* redir, int32_t flags)
 			sv->renamed[fd] = i;
 			INTON;
 		}
-		openredirect(n, memory);
+		if (n->nfile.type == NHERE || n->nfile.type == NXHERE)
+		{
+			herefd = herefds[h];
+			herefds[h++] = -1;
+			openredirect(n, memory, herefd);
+		}
+		else
+			openredirect(n, memory, -1);
 		INTON;
 		INTOFF;
 	}
+	handler = savehandler;
 	if (memory[1])
 		out1 = &memout;
 	if (memory[2])
@@ -156,7 +236,7 @@ redirect(union node* redir, int32_t flags)
 
 
 static void
-openredirect(union node* redir, char memory[10])
+openredirect(union node* redir, char memory[10], int32_t herefd)
 {
 	struct stat sb;
 	int32_t fd = redir->nfile.fd;
@@ -243,7 +323,7 @@ movefd:
 			break;
 		case NHERE:
 		case NXHERE:
-			f = openhere(redir);
+			f = herefd;
 			goto movefd;
 		default:
 			abort();
@@ -251,56 +331,300 @@ movefd:
 }
 
 
+/*
+ * Return the next part of a here-document, or NULL at the end.  An
+ * expanded document is expanded a piece at a time, see herepiece(), and
+ * the pieces are collected in hs->buf until there are HEREPIECE bytes; a
+ * single piece that is larger than that is returned from the stack, which
+ * the caller frees.
+ */
+
+static const_cstring_t
+herenext(struct herestream* hs, size_t* lenp)
+{
+	struct stackmark smark;
+	union node piece;
+	const_cstring_t end;
+	const_cstring_t p;
+	cstring_t text;
+	size_t len;
+	int32_t nbackq;
+	if (*hs->p == '\0')
+		return NULL;
+	if (!hs->expand)
+	{
+		p = hs->p;
+		*lenp = strlen(p);
+		hs->p = p + *lenp;
+		return p;
+	}
+	*lenp = 0;
+	while (*hs->p != '\0' && *lenp < HEREPIECE)
+	{
+		end = herepiece(hs->p, HEREPIECE, &nbackq);
+		setstackmark(&smark);
+		text = stalloc(end - hs->p + 1);
+		memcpy(text, hs->p, end - hs->p);
+		text[end - hs->p] = '\0';
+		piece.narg.type = NARG;
+		piece.narg.next = NULL;
+		piece.narg.text = text;
+		piece.narg.backquote = hs->bq;
+		piece.narg.literal = 0;
+		expandarg(&piece, (struct arglist*)NULL, 0);
+		for (; nbackq > 0 ; nbackq--)
+			hs->bq = hs->bq->next;
+		hs->p = end;
+		p = stackblock();
+		len = strlen(p);
+		if (*lenp == 0 && len >= HEREPIECE)
+		{
+			*lenp = len;
+			return p;
+		}
+		if (*lenp + len > hs->bufsize)
+		{
+			hs->bufsize = *lenp + len > 2 * HEREPIECE ?
+						  *lenp + len : 2 * HEREPIECE;
+			hs->buf = ckrealloc(hs->buf, hs->bufsize);
+		}
+		memcpy(hs->buf + *lenp, p, len);
+		*lenp += len;
+		popstackmark(&smark);
+	}
+	return hs->buf;
+}
+
+
+/*
+ * Create an anonymous file for a here-document: a memfd where the system
+ * has them, otherwise a temporary file in $TMPDIR that is unlinked at once.
+ * Returns -1 if no file could be created.
+ */
+
+static int32_t
+openherefile(void)
+{
+	char name[PATH_MAX];
+	const_cstring_t tmpdir;
+	int32_t fd;
+	fd = -1;
+#ifdef MFD_CLOEXEC
+	fd = memfd_create("sh-here", MFD_CLOEXEC);
+#endif
+	if (fd < 0)
+	{
+		tmpdir = lookupvar("TMPDIR");
+		if (tmpdir == NULL || *tmpdir != '/')
+			tmpdir = _PATH_TMP;
+		fmtstr(name, sizeof(name), "%s/sh-hereXXXXXX", tmpdir);
+		if ((fd = mkstemp(name)) < 0)
+			return -1;
+		unlink(name);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+}
+
+
 /*
  * Handle here documents.  Normally we fork off a process to write the
  * data to a pipe.  If the document is short, we can stuff the data in
- * the pipe without forking.
+ * the pipe without forking.  With SH_HEREDOC=file the document is put
+ * in an anonymous file instead, which needs no process whatever its size.
+ * Expanded documents are expanded a piece at a time as they are written;
+ * like a subshell, the expansion does not change the shell's variables.
+ * An expansion error closes the document and is passed on, so that the
+ * redirection fails rather than giving the command part of the document.
+ * If the pipe fills up, the writer process carries on from where the
+ * shell stopped.
  */
 
 static int32_t
 openhere(union node* redir)
 {
+	struct herestream hs;
+	struct stackmark smark;
+	struct jmploc jmploc;
+	struct jmploc* savehandler;
+	struct localvar* savelocalvars;
 	const_cstring_t p;
+	size_t len;
+	int32_t werr;
 	int32_t pip[2];
-	size_t len = 0;
-	int32_t flags;
-	ssize_t written = 0;
-	if (pipe(pip) < 0)
-		sherror("Pipe call failed: %s", strerror(errno));
-	if (redir->type == NXHERE)
-		p = redir->nhere.expdoc;
-	else
-		p = redir->nhere.doc->narg.text;
-	len = strlen(p);
-	if (len == 0)
-		goto out;
-	flags = fcntl(pip[1], F_GETFL, 0);
-	if (flags != -1 && fcntl(pip[1], F_SETFL, flags | O_NONBLOCK) != -1)
+	volatile int32_t flags;
+	volatile int32_t nonblock;
+	volatile int32_t fd;
+	ssize_t written;
+	hs.p = redir->nhere.doc->narg.text;
+	hs.bq = redir->nhere.doc->narg.backquote;
+	hs.expand = redir->type == NXHERE;
+	hs.buf = NULL;
+	hs.bufsize = 0;
+	pip[0] = pip[1] = -1;
+	flags = -1;
+	nonblock = 0;
+	fd = -1;
+	if (heredocmode == HEREDOC_FILE)
+		fd = openherefile();
+	if (fd < 0)
+	{
+		if (pipe(pip) < 0)
+			sherror("Pipe call failed: %s", strerror(errno));
+		fd = pip[1];
+		flags = fcntl(fd, F_GETFL, 0);
+		nonblock = flags != -1 &&
+				   fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+	}
+	p = NULL;
+	len = 0;
+	werr = 0;
+	setstackmark(&smark);
+	savelocalvars = localvars;
+	localvars = NULL;
+	forcelocal++;
+	savehandler = handler;
+	if (setjmp(jmploc.loc))
 	{
-		written = write(pip[1], p, len);
-		if (written < 0)
-			written = 0;
-		if ((size_t)written == len)
-			goto out;
-		fcntl(pip[1], F_SETFL, flags);
+		handler = savehandler;
+		forcelocal--;
+		poplocalvars();
+		localvars = savelocalvars;
+		popstackmark(&smark);
+		if (hs.buf)
+			ckfree(hs.buf);
+		close(fd);
+		if (pip[0] >= 0)
+			close(pip[0]);
+		longjmp(handler->loc, 1);
 	}
-	if (forkshell((struct job*)NULL, (union node*)NULL, FORK_NOJOB) == 0)
+	handler = &jmploc;
+	while ((p = herenext(&hs, &len)) != NULL)
 	{
-		close(pip[0]);
-		signal(SIGINT, SIG_IGN);
-		signal(SIGQUIT, SIG_IGN);
-		signal(SIGHUP, SIG_IGN);
-		signal(SIGTSTP, SIG_IGN);
-		signal(SIGPIPE, SIG_DFL);
-		xwrite(pip[1], p + written, len - written);
-		_exit(0);
+		if (pip[1] < 0)
+		{
+			if (len > INT32_MAX ||
+					xwrite(fd, p, (int32_t)len) != (int32_t)len)
+			{
+				werr = errno;
+				p = NULL;
+				break;
+			}
+		}
+		else
+		{
+			if (!nonblock)
+				break;
+			written = write(fd, p, len);
+			if (written < 0)
+				written = 0;
+			if ((size_t)written < len)
+			{
+				p += written;
+				len -= written;
+				break;
+			}
+		}
+		popstackmark(&smark);
 	}
-out:
+	INTOFF;
+	handler = savehandler;
+	forcelocal--;
+	poplocalvars();
+	localvars = savelocalvars;
+	if (pip[1] < 0)
+	{
+		popstackmark(&smark);
+		if (hs.buf)
+			ckfree(hs.buf);
+		if (werr != 0 || lseek(fd, 0, SEEK_SET) != 0)
+		{
+			close(fd);
+			sherror("cannot write here-document: %s",
+					strerror(werr != 0 ? werr : errno));
+		}
+		INTON;
+		return fd;
+	}
+	if (p != NULL)
+	{
+		if (nonblock)
+			fcntl(fd, F_SETFL, flags);
+		if (forkshell((struct job*)NULL, (union node*)NULL, FORK_NOJOB) == 0)
+		{
+			close(pip[0]);
+			signal(SIGINT, SIG_IGN);
+			signal(SIGQUIT, SIG_IGN);
+			signal(SIGHUP, SIG_IGN);
+			signal(SIGTSTP, SIG_IGN);
+			signal(SIGPIPE, SIG_DFL);
+			if (setjmp(jmploc.loc))
+				_exit(0);
+			handler = &jmploc;
+			if (xwrite(fd, p, (int32_t)len) != (int32_t)len)
+				_exit(0);
+			while ((p = herenext(&hs, &len)) != NULL &&
+					xwrite(fd, p, (int32_t)len) == (int32_t)len)
+				popstackmark(&smark);
+			_exit(0);
+		}
+	}
+	popstackmark(&smark);
+	if (hs.buf)
+		ckfree(hs.buf);
 	close(pip[1]);
+	INTON;
 	return pip[0];
 }
 
 
+/*
+ * Open the here-documents of a redirection list, in order, and store
+ * their file descriptors in fds.  The file descriptors are moved above 9
+ * so that the other redirections in the list cannot replace or save them.
+ */
+
+static void
+openheres(union node* redir, int32_t* fds)
+{
+	union node* n;
+	int32_t fd;
+	int32_t f;
+	for (n = redir ; n ; n = n->nfile.next)
+	{
+		if (n->nfile.type != NHERE && n->nfile.type != NXHERE)
+			continue;
+		fd = openhere(n);
+		if (fd < 10)
+		{
+			INTOFF;
+			f = fcntl(fd, F_DUPFD, 10);
+			close(fd);
+			INTON;
+			if (f < 0)
+				sherror("%d: %s", fd, strerror(errno));
+			fd = f;
+		}
+		*fds++ = fd;
+	}
+}
+
+
+/*
+ * Set the way here-documents are passed to commands from the value of
+ * SH_HEREDOC.  Unknown values select the default.
+ */
+
+void
+setheredocmode(const_cstring_t val)
+{
+	if (strcmp(val, "file") == 0)
+		heredocmode = HEREDOC_FILE;
+	else
+		heredocmode = HEREDOC_PIPE;
+}
+
+
 
 /*
  * Undo the effects of the last redirection.
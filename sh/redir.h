@@ -37,9 +37,16 @@
 #define REDIR_PUSH 01		/* save previous values of file descriptors */
 #define REDIR_BACKQ 02		/* save the command output in memory */
 
+/* Ways of passing here-documents, selected by SH_HEREDOC. */
+#define HEREDOC_PIPE 0		/* a pipe, with a writer process if it is full */
+#define HEREDOC_FILE 1		/* an anonymous file */
+
+extern int32_t heredocmode;	/* HEREDOC_* */
+
 union node;
 void redirect(union node*, int32_t);
 void popredir(void);
 int32_t fd0_redirected_p(void);
 void clearredir(void);
+void setheredocmode(const_cstring_t);
 
@@ -113,3 +113,14 @@ const_cstring_t const parsekwd[] =
 	"!",
 	0
 };
+
+#define KWDHASHSEED 40515U
+#define KWDHASHBITS 6
+
+const int8_t kwdhash[] =
+{
+	10, -1, -1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 6, -1, -1, 12, -1, 8,
+	4, -1, -1, -1, 5, -1, -1, 14, -1, 3, -1, -1, -1, -1, 7, -1,
+	1, 11, -1, -1, -1, -1, 0, -1, 2, -1, 13, -1, -1, -1, -1, -1,
+};
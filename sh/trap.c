@@ -375,6 +375,19 @@ getsigaction(int32_t signo, sig_t* sigact)
 }
 
 
+/*
+ * Return true if the shell ignores the signal for its own purposes, so
+ * that a child must restore the default action before it executes a
+ * command.  Signals ignored by a trap or on entry stay ignored.
+ */
+
+int32_t
+isshellignored(int32_t signo)
+{
+	return sigmode[signo] == S_IGN && trap[signo] == NULL;
+}
+
+
 /*
  * Ignore a signal.
  */
@@ -42,6 +42,7 @@ int32_t have_traps(void);
 void setsignal(int32_t);
 void ignoresig(int32_t);
 int32_t issigchldtrapped(void);
+int32_t isshellignored(int32_t);
 void onsig(int32_t);
 void dotrap(void);
 void setinteractive(int32_t);
@@ -45,6 +45,8 @@
 #include "nodes.h"	/* for other headers */
 #include "eval.h"	/* defines cmdenviron */
 #include "exec.h"
+#include "jobs.h"
+#include "redir.h"
 #include "syntax.h"
 #include "options.h"
 #include "mail.h"
@@ -62,8 +64,6 @@
  * Shell variables.
  */
 
-#define VTABSIZE 39
-
 
 typedef struct varinit
 {
@@ -87,6 +87,9 @@ struct var vps2;
 struct var vps4;
 static struct var voptind;
 struct var vdisvfork;
+struct var vforkmode;
+struct var vheredoc;
+struct var vjobtimes;
 
 int32_t forcelocal;
 
@@ -139,13 +142,37 @@ static const struct varinit varinit[] =
 		&vdisvfork,	VUNSET,				"SH_DISABLE_VFORK=",
 		NULL
 	},
+	{
+		&vforkmode,	VUNSET,				"SH_FORKMODE=",
+		setforkmode
+	},
+	{
+		&vheredoc,	VUNSET,				"SH_HEREDOC=",
+		setheredocmode
+	},
+	{
+		&vjobtimes,	VUNSET,				"SH_JOBTIMES=",
+		setjobtimes
+	},
 	{
 		NULL,	0,				NULL,
 		NULL
 	}
 };
 
-static struct var* vartab[VTABSIZE];
+static struct hashtab vartab = HASHTAB_INIT(MT_VAR);
+
+/*
+ * The environment for external commands.  It is kept up to date as
+ * variables are exported, changed and unset, so that environment() can
+ * hand it out without looking at every variable.  envvars[i] is the
+ * variable whose text is envvec[i].
+ */
+
+static cstring_t* envvec;
+static struct var** envvars;
+static int32_t nenv;
+static int32_t envsize;
 
 static const_cstring_t const locale_names[7] =
 {
@@ -158,8 +185,9 @@ static const int32_t locale_categories[7] =
 };
 
 static int32_t varequal(const_cstring_t, const_cstring_t);
-static struct var* find_var(const_cstring_t, struct var***, int32_t*);
+static struct var* find_var(const_cstring_t, int32_t*, uint32_t*);
 static int32_t localevar(const_cstring_t);
+static void envsync(struct var*);
 
 extern cstring_t* environ;
 
@@ -174,14 +202,13 @@ initvar(void)
 	char ppid[20];
 	const struct varinit* ip;
 	struct var* vp;
-	struct var** vpp;
+	uint32_t hashval;
 	cstring_t* envp;
 	for (ip = varinit ; (vp = ip->var) != NULL ; ip++)
 	{
-		if (find_var(ip->text, &vpp, &vp->name_len) != NULL)
+		if (find_var(ip->text, &vp->name_len, &hashval) != NULL)
 			continue;
-		vp->next = *vpp;
-		*vpp = vp;
+		hashinsert(&vartab, &vp->hent, hashval);
 		vp->text = __DECONST(cstring_t, ip->text);
 		vp->flags = ip->flags | VSTRFIXED | VTEXTFIXED;
 		vp->func = ip->func;
@@ -189,10 +216,9 @@ initvar(void)
 	/*
 	 * PS1 depends on uid
 	 */
-	if (find_var("PS1", &vpp, &vps1.name_len) == NULL)
+	if (find_var("PS1", &vps1.name_len, &hashval) == NULL)
 	{
-		vps1.next = *vpp;
-		*vpp = &vps1;
+		hashinsert(&vartab, &vps1.hent, hashval);
 		vps1.text = __DECONST(cstring_t, geteuid() ? "PS1=$ " : "PS1=# ");
 		vps1.flags = VSTRFIXED | VTEXTFIXED;
 	}
@@ -339,13 +365,14 @@ change_env(const_cstring_t s, int32_t set)
 void
 setvareq(cstring_t s, int32_t flags)
 {
-	struct var* vp, **vpp;
+	struct var* vp;
 	int32_t nlen;
+	uint32_t hashval;
 	if (aflag)
 		flags |= VEXPORT;
 	if (forcelocal && !(flags & (VNOSET | VNOLOCAL)))
 		mklocal(s);
-	vp = find_var(s, &vpp, &nlen);
+	vp = find_var(s, &nlen, &hashval);
 	if (vp != NULL)
 	{
 		if (vp->flags & VREADONLY)
@@ -368,6 +395,9 @@ setvareq(cstring_t s, int32_t flags)
 		vp->flags &= ~(VTEXTFIXED | VSTACK | VUNSET);
 		vp->flags |= flags;
 		vp->text = s;
+		if ((flags & (VTEXTFIXED | VSTACK)) == 0)
+			cksettag(s, MT_VAR);
+		envsync(vp);
 		/*
 		 * We could roll this to a function, to handle it as
 		 * a regular variable function callback, but why bother?
@@ -396,13 +426,16 @@ setvareq(cstring_t s, int32_t flags)
 		return;
 	}
 	INTOFF;
-	vp = ckmalloc(sizeof(*vp));
+	vp = ckmalloctag(sizeof(*vp), MT_VAR);
 	vp->flags = flags;
 	vp->text = s;
+	if ((flags & (VTEXTFIXED | VSTACK)) == 0)
+		cksettag(s, MT_VAR);
 	vp->name_len = nlen;
-	vp->next = *vpp;
 	vp->func = NULL;
-	*vpp = vp;
+	vp->envslot = 0;
+	hashinsert(&vartab, &vp->hent, hashval);
+	envsync(vp);
 	if ((vp->flags & VEXPORT) && localevar(s))
 	{
 		change_env(s, 1);
@@ -559,33 +592,118 @@ initcharset(void)
 }
 
 /*
- * Generate a list of exported variables.  This routine is used to construct
- * the third argument to execve when executing a program.
+ * Bring the environment vector up to date after a change to the text or
+ * the export flag of a variable.  A variable that is no longer exported
+ * is replaced by the last entry, so the order of the vector is arbitrary.
+ */
+
+static void
+envsync(struct var* vp)
+{
+	struct var* last;
+	int32_t i;
+	INTOFF;
+	if (vp->flags & VEXPORT)
+	{
+		if (vp->envslot == 0)
+		{
+			if (nenv + 1 >= envsize)
+			{
+				envsize = envsize == 0 ? 64 : envsize * 2;
+				if (envvec == NULL)
+				{
+					envvec = ckmalloctag(envsize * sizeof(*envvec), MT_VAR);
+					envvars = ckmalloctag(envsize * sizeof(*envvars), MT_VAR);
+				}
+				else
+				{
+					envvec = ckrealloc(envvec, envsize * sizeof(*envvec));
+					envvars = ckrealloc(envvars, envsize * sizeof(*envvars));
+				}
+			}
+			envvars[nenv] = vp;
+			vp->envslot = ++nenv;
+			envvec[nenv] = NULL;
+		}
+		envvec[vp->envslot - 1] = vp->text;
+	}
+	else if (vp->envslot != 0)
+	{
+		i = vp->envslot - 1;
+		last = envvars[--nenv];
+		envvars[i] = last;
+		envvec[i] = envvec[nenv];
+		last->envslot = i + 1;
+		envvec[nenv] = NULL;
+		vp->envslot = 0;
+	}
+	INTON;
+}
+
+
+/*
+ * Return the list of exported variables.  This routine is used to construct
+ * the third argument to execve when executing a program.  The list belongs
+ * to this file and changes with the variables; it must not be modified.
  */
 
 cstring_t*
 environment(void)
 {
-	int32_t nenv;
-	struct var** vpp;
+	static cstring_t noenv[1];
+	return envvec != NULL ? envvec : noenv;
+}
+
+
+/*
+ * Return the environment for an external command run with the variable
+ * assignments in list, without making the assignments.  Returns NULL if
+ * one of them would fail; the caller must then assign them in a child.
+ */
+
+cstring_t*
+cmdenvironment(struct strlist* list)
+{
+	struct strlist* sp;
+	struct strlist* sp2;
 	struct var* vp;
-	cstring_t* env, **ep;
-	nenv = 0;
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++)
+	cstring_t* env;
+	cstring_t* ep;
+	cstring_t* newenv;
+	int32_t n;
+	n = 0;
+	for (sp = list ; sp ; sp = sp->next)
 	{
-		for (vp = *vpp ; vp ; vp = vp->next)
-			if (vp->flags & VEXPORT)
-				nenv++;
+		vp = find_var(sp->text, NULL, NULL);
+		if (vp != NULL && vp->flags & VREADONLY)
+			return NULL;
+		n++;
 	}
-	ep = env = stalloc((nenv + 1) * sizeof * env);
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++)
+	env = environment();
+	if (list == NULL)
+		return env;
+	for (ep = env ; *ep ; ep++)
+		n++;
+	ep = newenv = stalloc((n + 1) * sizeof * newenv);
+	for (; *env ; env++)
 	{
-		for (vp = *vpp ; vp ; vp = vp->next)
-			if (vp->flags & VEXPORT)
-				* ep++ = vp->text;
+		for (sp = list ; sp ; sp = sp->next)
+			if (varequal(*env, sp->text))
+				break;
+		if (sp == NULL)
+			*ep++ = *env;
+	}
+	for (sp = list ; sp ; sp = sp->next)
+	{
+		/* The last assignment to a variable wins. */
+		for (sp2 = sp->next ; sp2 ; sp2 = sp2->next)
+			if (varequal(sp->text, sp2->text))
+				break;
+		if (sp2 == NULL)
+			*ep++ = sp->text;
 	}
 	*ep = NULL;
-	return env;
+	return newenv;
 }
 
 
@@ -613,7 +731,7 @@ var_compare(const_pvoid_t a, const_pvoid_t b)
 int32_t
 showvarscmd(int32_t argc __unused, cstring_t* argv __unused)
 {
-	struct var** vpp;
+	struct hashent* hp;
 	struct var* vp;
 	const_cstring_t s;
 	const_cstring_t* vars;
@@ -622,24 +740,20 @@ showvarscmd(int32_t argc __unused, cstring_t* argv __unused)
 	 * POSIX requires us to sort the variables.
 	 */
 	n = 0;
-	for (vpp = vartab; vpp < vartab + VTABSIZE; vpp++)
+	for (hp = hashnext(&vartab, NULL); hp; hp = hashnext(&vartab, hp))
 	{
-		for (vp = *vpp; vp; vp = vp->next)
-		{
-			if (!(vp->flags & VUNSET))
-				n++;
-		}
+		vp = (struct var*)hp;
+		if (!(vp->flags & VUNSET))
+			n++;
 	}
 	INTOFF;
 	vars = ckmalloc(n * sizeof(*vars));
 	i = 0;
-	for (vpp = vartab; vpp < vartab + VTABSIZE; vpp++)
+	for (hp = hashnext(&vartab, NULL); hp; hp = hashnext(&vartab, hp))
 	{
-		for (vp = *vpp; vp; vp = vp->next)
-		{
-			if (!(vp->flags & VUNSET))
-				vars[i++] = vp->text;
-		}
+		vp = (struct var*)hp;
+		if (!(vp->flags & VUNSET))
+			vars[i++] = vp->text;
 	}
 	qsort(vars, n, sizeof(*vars), var_compare);
 	for (i = 0; i < n; i++)
@@ -670,7 +784,7 @@ showvarscmd(int32_t argc __unused, cstring_t* argv __unused)
 int32_t
 exportcmd(int32_t argc __unused, cstring_t* argv)
 {
-	struct var** vpp;
+	struct hashent* hp;
 	struct var* vp;
 	cstring_t* ap;
 	cstring_t name;
@@ -705,6 +819,7 @@ exportcmd(int32_t argc __unused, cstring_t* argv)
 				if (vp != NULL)
 				{
 					vp->flags |= flag;
+					envsync(vp);
 					if ((vp->flags & VEXPORT) && localevar(vp->text))
 					{
 						change_env(vp->text, 1);
@@ -719,36 +834,34 @@ exportcmd(int32_t argc __unused, cstring_t* argv)
 	}
 	else
 	{
-		for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++)
+		for (hp = hashnext(&vartab, NULL) ; hp ; hp = hashnext(&vartab, hp))
 		{
-			for (vp = *vpp ; vp ; vp = vp->next)
+			vp = (struct var*)hp;
+			if (vp->flags & flag)
 			{
-				if (vp->flags & flag)
+				if (values)
 				{
-					if (values)
-					{
-						/*
-						 * Skip improper variable names
-						 * so the output remains usable
-						 * as shell input.
-						 */
-						if (!isassignment(vp->text))
-							continue;
-						out1str(cmdname);
-						out1c(' ');
-					}
-					if (values && !(vp->flags & VUNSET))
-					{
-						outbin(vp->text,
-							   vp->name_len + 1, out1);
-						out1qstr(vp->text +
-								 vp->name_len + 1);
-					}
-					else
-						outbin(vp->text, vp->name_len,
-							   out1);
-					out1c('\n');
+					/*
+					 * Skip improper variable names
+					 * so the output remains usable
+					 * as shell input.
+					 */
+					if (!isassignment(vp->text))
+						continue;
+					out1str(cmdname);
+					out1c(' ');
 				}
+				if (values && !(vp->flags & VUNSET))
+				{
+					outbin(vp->text,
+						   vp->name_len + 1, out1);
+					out1qstr(vp->text +
+							 vp->name_len + 1);
+				}
+				else
+					outbin(vp->text, vp->name_len,
+						   out1);
+				out1c('\n');
 			}
 		}
 	}
@@ -786,26 +899,25 @@ void
 mklocal(cstring_t name)
 {
 	struct localvar* lvp;
-	struct var** vpp;
 	struct var* vp;
 	INTOFF;
-	lvp = ckmalloc(sizeof(struct localvar));
+	lvp = ckmalloctag(sizeof(struct localvar), MT_VAR);
 	if (name[0] == '-' && name[1] == '\0')
 	{
-		lvp->text = ckmalloc(sizeof optlist);
+		lvp->text = ckmalloctag(sizeof optlist, MT_VAR);
 		memcpy(lvp->text, optlist, sizeof optlist);
 		vp = NULL;
 	}
 	else
 	{
-		vp = find_var(name, &vpp, NULL);
+		vp = find_var(name, NULL, NULL);
 		if (vp == NULL)
 		{
 			if (strchr(name, '='))
 				setvareq(savestr(name), VSTRFIXED | VNOLOCAL);
 			else
 				setvar(name, NULL, VSTRFIXED | VNOLOCAL);
-			vp = *vpp;	/* the new variable */
+			vp = find_var(name, NULL, NULL);	/* the new variable */
 			lvp->text = NULL;
 			lvp->flags = VUNSET;
 		}
@@ -855,6 +967,7 @@ poplocalvars(void)
 				ckfree(vp->text);
 			vp->flags = lvp->flags;
 			vp->text = lvp->text;
+			envsync(vp);
 		}
 		ckfree(lvp);
 	}
@@ -917,9 +1030,8 @@ unsetcmd(int32_t argc __unused, cstring_t* argv __unused)
 int32_t
 unsetvar(const_cstring_t s)
 {
-	struct var** vpp;
 	struct var* vp;
-	vp = find_var(s, &vpp, NULL);
+	vp = find_var(s, NULL, NULL);
 	if (vp == NULL)
 		return (0);
 	if (vp->flags & VREADONLY)
@@ -934,11 +1046,12 @@ unsetvar(const_cstring_t s)
 	}
 	vp->flags &= ~VEXPORT;
 	vp->flags |= VUNSET;
+	envsync(vp);
 	if ((vp->flags & VSTRFIXED) == 0)
 	{
 		if ((vp->flags & VTEXTFIXED) == 0)
 			ckfree(vp->text);
-		*vpp = vp->next;
+		hashremove(&vartab, &vp->hent);
 		ckfree(vp);
 	}
 	return (0);
@@ -968,34 +1081,33 @@ varequal(const_cstring_t p, const_cstring_t q)
 /*
  * Search for a variable.
  * 'name' may be terminated by '=' or a NUL.
- * vppp is set to the pvoid_t to vp, or the list head if vp isn't found
  * lenp is set to the number of characters in 'name'
+ * hashp is set to the hash of the name, for adding it to vartab
  */
 
 static struct var*
-find_var(const_cstring_t name, struct var*** vppp, int32_t* lenp)
+find_var(const_cstring_t name, int32_t* lenp, uint32_t* hashp)
 {
 	uint32_t hashval;
 	size_t len;
-	struct var* vp, **vpp;
+	struct hashent* hp;
+	struct var* vp;
 	const_cstring_t p = name;
-	hashval = 0;
 	while (*p && *p != '=')
-		hashval = 2 * hashval + (char32_t)*p++;
+		p++;
 	len = p - name;
+	hashval = hashmem(name, len);
 	if (lenp)
 		*lenp = len;
-	vpp = &vartab[hashval % VTABSIZE];
-	if (vppp)
-		*vppp = vpp;
-	for (vp = *vpp ; vp ; vpp = &vp->next, vp = *vpp)
+	if (hashp)
+		*hashp = hashval;
+	for (hp = hashfirst(&vartab, hashval) ; hp ; hp = hp->next)
 	{
-		if (vp->name_len != len)
+		vp = (struct var*)hp;
+		if (hp->hash != hashval || vp->name_len != len)
 			continue;
 		if (memcmp(vp->text, name, len) != 0)
 			continue;
-		if (vppp)
-			*vppp = vpp;
 		return vp;
 	}
 	return NULL;
@@ -37,6 +37,8 @@
  * Shell variables.
  */
 
+#include "hashtab.h"
+
 /* flags */
 #define VEXPORT		0x01	/* variable is exported */
 #define VREADONLY	0x02	/* variable cannot be modified */
@@ -51,10 +53,11 @@
 
 struct var
 {
-	struct var* next;		/* next entry in hash list */
+	struct hashent hent;	/* hash table link, must be first */
 	int32_t flags;			/* flags are defined above */
 	int32_t name_len;			/* length of name */
 	cstring_t text;			/* name=value */
+	int32_t envslot;		/* 1 + index in environment(), or 0 */
 	void (*func)(const_cstring_t);
 	/* function to be called when  */
 	/* the variable gets set/unset */
@@ -81,6 +84,9 @@ extern struct var vps1;
 extern struct var vps2;
 extern struct var vps4;
 extern struct var vdisvfork;
+extern struct var vforkmode;
+extern struct var vheredoc;
+extern struct var vjobtimes;
 #ifndef NO_HISTORY
 extern struct var vhistsize;
 extern struct var vterm;
@@ -125,6 +131,7 @@ void bltinunsetlocale(void);
 void updatecharset(void);
 void initcharset(void);
 cstring_t* environment(void);
+cstring_t* cmdenvironment(struct strlist*);
 int32_t showvarscmd(int32_t, cstring_t*);
 void mklocal(cstring_t);
 void poplocalvars(void);